@@ -0,0 +1,205 @@
+// ----------------------------------------------------------------------------
+// compact formatter: CF_snprintf() from cformat.c against the C library's
+// snprintf() over every combination of flags, width, precision and length
+// modifier cformat.h lists, plus truncation into small buffers. Exact halves
+// in %f are allowed to differ (cformat rounds them up, glibc and newlib to
+// even), anything else counts as a mismatch. Then both get timed, and so do
+// Con_printf() and the vsnprintf() + Con_fputs() pair it replaced
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "display.h"
+#include "conio.h"
+#include "cformat.h"
+
+#define CALLS 1000000
+#define CONSOLE_CALLS 200000
+#define RUNS 5
+
+static int checks, bad, halves;
+static int decimals;		// precision of the %f conversion being checked, -1 none
+
+// is v exactly half way between two numbers with the given number of decimals
+static int _IsHalf(double v, int prec) {
+	double scaled = fabs(v) * pow(10, prec);
+	return scaled - floor(scaled) == 0.5;
+}
+
+static void _Check(double half, const char *format, ...) {
+	char want[256], got[256];
+	va_list ap;
+	va_start(ap, format);
+	int n1 = vsnprintf(want, sizeof(want), format, ap);
+	va_end(ap);
+	va_start(ap, format);
+	int n2 = CF_vsnprintf(got, sizeof(got), format, ap);
+	va_end(ap);
+
+	checks++;
+	if (n1 == n2 && !strcmp(want, got))
+		return;
+	if (decimals >= 0 && _IsHalf(half, decimals)) {
+		halves++;
+		return;
+	}
+	if (++bad <= 20)
+		printf("mismatch \"%s\": [%s] %d vs [%s] %d\n", format, want, n1, got, n2);
+}
+
+static void _CheckIntegers() {
+	static const char *flags[] = { "", "-", "0", "+", " ", "#", "-0", "+0", "- ", "#0", "-#" };
+	static const char *widths[] = { "", "1", "5", "12" };
+	static const char *precs[] = { "", ".0", ".1", ".3", ".8" };
+	static const char *convs[] = { "d", "i", "u", "x", "X", "o", "ld", "lld", "hd", "hhd", "lu", "lx", "zu" };
+	static const long long values[] = { 0, 1, -1, 7, -42, 255, 65535, -32768, 2147483647LL,
+		-2147483648LL, 4294967295LL, 1234567890123LL, -9876543210LL };
+	char format[64];
+
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++)
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+	for (size_t p = 0; p < sizeof(precs) / sizeof(precs[0]); p++)
+	for (size_t c = 0; c < sizeof(convs) / sizeof(convs[0]); c++)
+	for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+		const char *conv = convs[c];
+		long long value = values[v];
+		snprintf(format, sizeof(format), "<%%%s%s%s%s>", flags[f], widths[w], precs[p], conv);
+		if (!strcmp(conv, "lld"))
+			_Check(0, format, value);
+		else if (conv[0] == 'l')
+			_Check(0, format, (long)value);
+		else if (conv[0] == 'z')
+			_Check(0, format, (size_t)value);
+		else
+			_Check(0, format, (int)value);
+	}
+}
+
+static void _CheckStrings() {
+	static const char *flags[] = { "", "-", "0" };
+	static const char *widths[] = { "", "1", "5", "12" };
+	static const char *precs[] = { "", ".0", ".1", ".3", ".8" };
+	char format[64];
+
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++)
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+	for (size_t p = 0; p < sizeof(precs) / sizeof(precs[0]); p++) {
+		// no 0 flag on %c, that one is undefined
+		snprintf(format, sizeof(format), "<%%%s%s%ss|%%%s%sc>", flags[f], widths[w], precs[p],
+			flags[f][0] == '0' ? "" : flags[f], widths[w]);
+		_Check(0, format, "hello world", 'Z');
+	}
+}
+
+static void _CheckFixedPoint() {
+	static const char *flags[] = { "", "-", "0", "+", " ", "#", "-0", "+0", "- ", "#0", "-#" };
+	static const char *widths[] = { "", "1", "5", "12" };
+	static const char *precs[] = { "", ".0", ".1", ".3", ".8", ".9", ".10", ".17", ".40" };
+	static const int digits[] = { 6, 0, 1, 3, 8, 9, 10, 17, 40 };
+	static const double values[] = { 0, -0.0, 1, -1, 0.5, 1.25, 3.14159265, -2.71828, 123456.789,
+		0.0000123, 99.9999999, 1e10, -0.001, 0.1, 2.5e-10, 0.9999999999999999,
+		1.5e19, 18446744073709549568.0, 18446744073709551616.0, -1e20,
+		123456789012345678901234567890.0, 1e300, 1.7976931348623157e308, 5e-324 };
+	char format[64];
+
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++)
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+	for (size_t p = 0; p < sizeof(precs) / sizeof(precs[0]); p++)
+	for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+		snprintf(format, sizeof(format), "<%%%s%s%sf>", flags[f], widths[w], precs[p]);
+		decimals = digits[p];
+		_Check(values[v], format, values[v]);
+	}
+	decimals = -1;
+}
+
+static int _LibcFormat(char *buf, size_t size, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int n = vsnprintf(buf, size, format, ap);
+	va_end(ap);
+	return n;
+}
+
+// the return value is the untruncated length, the output always terminated
+static void _CheckTruncation() {
+	for (size_t size = 0; size < 24; size++) {
+		char want[32], got[32];
+		memset(want, 'x', sizeof(want));
+		memset(got, 'x', sizeof(got));
+		int n1 = _LibcFormat(want, size, "%s %5d %08x", "FILE.TXT", 42, 0xbeefu);
+		int n2 = CF_snprintf(got, size, "%s %5d %08x", "FILE.TXT", 42, 0xbeefu);
+		checks++;
+		if (n1 != n2 || memcmp(want, got, sizeof(want))) {
+			if (++bad <= 20)
+				printf("mismatch truncating to %zu bytes: %d vs %d\n", size, n1, n2);
+		}
+	}
+}
+
+static double _Now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static volatile int sink;
+
+// ns per call, best of RUNS
+#define TIME(best, calls, call) do { \
+		for (int run = 0; run < RUNS; run++) { \
+			double t = _Now(); \
+			for (int i = 0; i < (calls); i++) \
+				sink += call; \
+			t = (_Now() - t) / (calls); \
+			if (!run || t < best) \
+				best = t; \
+		} \
+	} while (0)
+
+// what Con_printf() did before: format into a buffer, then write that
+static int _StagedPrintf(const char *format, ...) {
+	static char buffer[512];
+	va_list ap;
+	va_start(ap, format);
+	int n = vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+	Con_fputs(buffer, stdout);
+	return n;
+}
+
+int main() {
+	decimals = -1;
+	_CheckIntegers();
+	_CheckStrings();
+	_CheckFixedPoint();
+	_CheckTruncation();
+	_Check(0, "%s %d %% %c %08x %10ld %-12s|", "abc", 5, 'q', 0xbeefu, 123456L, "left");
+	_Check(0, "%*d|%-*d|%.*s|", 6, 42, 6, 42, 3, "abcdef");
+	_Check(0, "%p", (void *)0x1234);
+	printf("%d checks, %d mismatches, %d exact halves rounded up\n", checks, bad, halves);
+
+	char buf[256];
+	double libc = 0, cf = 0;
+	TIME(libc, CALLS, snprintf(buf, sizeof(buf), "%s %5d %08x %-10s %lu\n", "FILE.TXT", i, i * 7, "dir", (unsigned long)i * 13));
+	TIME(cf, CALLS, CF_snprintf(buf, sizeof(buf), "%s %5d %08x %-10s %lu\n", "FILE.TXT", i, i * 7, "dir", (unsigned long)i * 13));
+	printf("mixed line     snprintf %5.0f ns  CF_snprintf %5.0f ns\n", libc, cf);
+	TIME(libc, CALLS, snprintf(buf, sizeof(buf), "%d", i));
+	TIME(cf, CALLS, CF_snprintf(buf, sizeof(buf), "%d", i));
+	printf("%%d             snprintf %5.0f ns  CF_snprintf %5.0f ns\n", libc, cf);
+
+	DisplayOpen();
+	ConOpen();
+	double staged = 0, streamed = 0;
+	TIME(staged, CONSOLE_CALLS, _StagedPrintf("%-12s %8d %08x\n", "FILE.TXT", i, i * 7));
+	TIME(streamed, CONSOLE_CALLS, Con_printf("%-12s %8d %08x\n", "FILE.TXT", i, i * 7));
+	printf("console line   vsnprintf + Con_fputs %5.0f ns  Con_printf %5.0f ns\n", staged, streamed);
+	return bad != 0;
+}
+
+// format_bench.c
@@ -0,0 +1,39 @@
+// ----------------------------------------------------------------------------
+// host stand-ins for the parts of the firmware the benchmarks do not build:
+// the mode table (geometry only), the uart bridge, the input pump and the
+// latency probe
+// ----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "display.h"
+#include "latency.h"
+#include "uartcon.h"
+#include "input.h"
+
+const struct DisplayMode DISPLAY_MODES[D_MODE_COUNT] = {
+	[D_MODE_TEXT]        = { "text 40x30",   320, 240, 40, 30,            0, 0 },
+	[D_MODE_FRAMEBUFFER] = { "rgb332 8bpp",  320, 240, 40, 30,            8, 320*240 },
+	[D_MODE_TEXT80]      = { "text 80x30",   640, 240, 80, D_TEXT80_ROWS, 0, 0 },
+	[D_MODE_BITMAP]      = { "bitmap 1bpp",  640, 240, 40, 30,            1, 640*240/8 },
+	[D_MODE_PAL2]        = { "palette 2bpp", 320, 240, 40, 30,            2, 320*240/4 },
+	[D_MODE_PAL4]        = { "palette 4bpp", 320, 240, 40, 30,            4, 320*240/2 },
+};
+const struct DisplayMode *D_MODE = &DISPLAY_MODES[D_MODE_TEXT];
+
+uint8_t *FRAMEBUF = NULL;
+
+volatile uint8_t lat_state = LAT_IDLE;
+void LAT_GlyphWritten(int row) { (void)row; }
+
+void InputPump() {}
+void InputRecordLatency(uint64_t time_us) { (void)time_us; }
+
+void UC_Write(const char *p, int n) { (void)p; (void)n; }
+void UC_CursorTo(int row, int col) { (void)row; (void)col; }
+void UC_Color(int fg, int bg) { (void)fg; (void)bg; }
+void UC_ClearRow() {}
+void UC_ClearScreen() {}
+
+// host.c
@@ -0,0 +1,5 @@
+// host stand-in: sdcard.h includes it, nothing from it is used
+
+#pragma once
+
+// f_util.h
@@ -0,0 +1,28 @@
+// ----------------------------------------------------------------------------
+// host stand-in for FatFs: just what sdreader.c needs. A file is a block of
+// memory, sdreader_test.c opens it
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <stdint.h>
+
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+
+typedef enum { FR_OK = 0, FR_DISK_ERR, FR_NO_FILE = 4, FR_NOT_ENOUGH_CORE = 17 } FRESULT;
+
+#define FA_READ 0x01
+
+typedef struct { void *fs; } FFOBJID;
+typedef struct {
+	FFOBJID obj;
+	const uint8_t *data;
+	UINT size, pos;
+} FIL;
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buf, UINT btr, UINT *br);
+
+// ff.h
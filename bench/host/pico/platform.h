@@ -0,0 +1,6 @@
+#pragma once
+
+// host builds: no RAM placement of time critical functions
+#define __not_in_flash_func(f) f
+
+// platform.h
@@ -0,0 +1,209 @@
+// ----------------------------------------------------------------------------
+// text scanline renderer: RenderTextScanlineBuf() from display.c against the
+// per pixel loop it replaced and the monochrome table loop that came in between.
+// The baseline and the renderer have to produce the same pixels for the default
+// colours (white on blue) in either flash state, and a per pixel colour loop the
+// same as the renderer for a screen in all colours. Then every scanline of a full
+// 40x30 screen gets rendered over and over and timed
+// ----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "display.h"
+
+extern unsigned char bescii[];		// besciifont.h, built into display.c
+
+#define CELLS (30 * 40)
+#define ROUNDS 200
+#define RUNS 50
+
+static uint8_t snapshot[3 * CELLS];		// DisplaySaveScreen(): chars, attributes, colours
+static uint32_t line[D_FRAME_WIDTH / 4];
+static uint32_t ref[D_FRAME_WIDTH / 4];
+
+static const uint8_t masks[8] = { 128,64,32,16,8,4,2,1 };
+
+// the reference loops must not learn more about their arguments than display.c does
+#if defined(__GNUC__) && !defined(__clang__)
+#define OPAQUE __attribute__((noipa))
+#else
+#define OPAQUE __attribute__((noinline))
+#endif
+
+// the original loop: test every glyph bit and store the pixel
+static void OPAQUE _BaselineScanline(uint8_t *dst, int y, int flash) {
+	int char_row = y / D_FONT_HEIGHT;
+	int offset = y % D_FONT_HEIGHT;
+	int index = char_row * 40;
+	const char *charbuf = (const char *)snapshot;
+	const uint8_t *attrbuf = snapshot + CELLS;
+
+	for (int i = 0; i < 40; i++) {
+		char c = charbuf[index + i] - D_FONT_FIRST_ASCII;
+		uint8_t a = attrbuf[index + i];
+		uint8_t src_pixels = bescii[c * D_FONT_HEIGHT + offset];
+		if ((a & D_ATTR_INVERSE) || ((a & D_ATTR_FLASH) && flash))
+			src_pixels ^= 0xff;
+		for (int bit = 0; bit < 8; bit++) {
+			*dst = 0x03;
+			if (src_pixels & masks[bit])
+				*dst = 0xff;
+			dst++;
+		}
+	}
+}
+
+// per pixel in the cell's own colours (palette entry n set to rgb332 value n * 17)
+static void _ColorScanline(uint8_t *dst, int y, int flash) {
+	int index = (y / D_FONT_HEIGHT) * 40;
+	const uint8_t *attrbuf = snapshot + CELLS;
+	const uint8_t *colbuf = snapshot + 2 * CELLS;
+
+	for (int i = 0; i < 40; i++) {
+		uint8_t a = attrbuf[index + i];
+		uint8_t fg = (colbuf[index + i] & 0x0f) * 17;
+		uint8_t bg = (colbuf[index + i] >> 4) * 17;
+		uint8_t src_pixels = bescii[(snapshot[index + i] - D_FONT_FIRST_ASCII) * D_FONT_HEIGHT + y % D_FONT_HEIGHT];
+		if ((a & D_ATTR_INVERSE) || ((a & D_ATTR_FLASH) && flash))
+			src_pixels ^= 0xff;
+		for (int bit = 0; bit < 8; bit++)
+			*dst++ = (src_pixels & masks[bit]) ? fg : bg;
+	}
+}
+
+// the user-001 loop: one expansion table lookup per cell, fixed colours, no palette
+static uint32_t mono_expand[256][2];
+static uint8_t mono_xor[4] = { 0x00, 0xff, 0x00, 0xff };	// by inverse and flash bit, flash off
+
+static void OPAQUE _MonoScanline(uint32_t *dst, int y) {
+	int index = (y / D_FONT_HEIGHT) * 40;
+	const uint8_t *font = bescii + y % D_FONT_HEIGHT - D_FONT_FIRST_ASCII * D_FONT_HEIGHT;
+	const uint8_t *charbuf = snapshot;
+	const uint8_t *attrbuf = snapshot + CELLS;
+
+	for (int i = 0; i < 40; i++) {
+		uint8_t a = attrbuf[index + i] & (D_ATTR_INVERSE | D_ATTR_FLASH);
+		const uint32_t *pixels = mono_expand[font[charbuf[index + i] * D_FONT_HEIGHT] ^ mono_xor[a]];
+		*dst++ = pixels[0];
+		*dst++ = pixels[1];
+	}
+}
+
+static void _BuildMonoTable() {
+	for (int g = 0; g < 256; g++) {
+		uint8_t pixels[8];
+		for (int bit = 0; bit < 8; bit++)
+			pixels[bit] = (g & masks[bit]) ? 0xff : 0x03;
+		memcpy(mono_expand[g], pixels, 8);
+	}
+}
+
+static void _Baseline(int y) {
+	_BaselineScanline((uint8_t *)ref, y, 0);
+}
+
+static void _Mono(int y) {
+	_MonoScanline(ref, y);
+}
+
+static void _Renderer(int y) {
+	RenderTextScanlineBuf(line, y);
+}
+
+static double _Now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// ns per scanline of one run
+static double _Time(void (*render)(int y)) {
+	double t = _Now();
+	for (int n = 0; n < ROUNDS; n++)
+		for (int y = 0; y < 240; y++)
+			render(y);
+	return (_Now() - t) / (ROUNDS * 240.0);
+}
+
+static void _Best(double *best, double t, int run) {
+	if (!run || t < *best)
+		*best = t;
+}
+
+// the flash state only changes every D_FLASH_DELAY frames
+static void _ToggleFlash() {
+	for (int i = 0; i < D_FLASH_DELAY; i++)
+		RenderTextDisplay();
+}
+
+// some text with inverse and flashing cells, all in one colour or in all of them
+static void _FillScreen(int colorful) {
+	for (int row = 0; row < 30; row++) {
+		for (int col = 0; col < 40; col++) {
+			int i = row * 40 + col;
+			SetPenColor(colorful ? (uint8_t)(i * 37) : D_COLOR_DEFAULT);
+			PutCharacter(32 + (i * 7) % 95, row, col);
+			if (i % 13 == 0)
+				SetAttribute(D_ATTR_INVERSE, row, col);
+			else if (i % 17 == 0)
+				SetAttribute(D_ATTR_FLASH, row, col);
+		}
+	}
+	DisplaySaveScreen(snapshot);
+}
+
+int main() {
+	int bad = 0;
+
+	DisplayOpen();
+	_FillScreen(0);
+	for (int flash = 0; flash < 2; flash++) {
+		for (int y = 0; y < 240; y++) {
+			_BaselineScanline((uint8_t *)ref, y, flash);
+			RenderTextScanlineBuf(line, y);
+			if (memcmp(ref, line, sizeof(line)))
+				bad++;
+		}
+		_ToggleFlash();
+	}
+	printf("scanlines differing from the baseline: %d\n", bad);
+
+	int wrong = 0;
+	for (int n = 0; n < 16; n++)
+		SetPaletteColor(n, n * 17);
+	_FillScreen(1);
+	for (int flash = 0; flash < 2; flash++) {
+		for (int y = 0; y < 240; y++) {
+			_ColorScanline((uint8_t *)ref, y, flash);
+			RenderTextScanlineBuf(line, y);
+			if (memcmp(ref, line, sizeof(line)))
+				wrong++;
+		}
+		_ToggleFlash();
+	}
+	printf("scanlines in the wrong colours: %d\n", wrong);
+	bad += wrong;
+
+	// the host is not quiet: the candidates take turns and the best run of each counts
+	double baseline = 0, mono = 0, plain = 0, colorful = 0;
+	_BuildMonoTable();
+	for (int run = 0; run < RUNS; run++) {
+		_FillScreen(0);
+		_Best(&baseline, _Time(_Baseline), run);
+		_Best(&mono, _Time(_Mono), run);
+		_Best(&plain, _Time(_Renderer), run);
+		_FillScreen(1);
+		_Best(&colorful, _Time(_Renderer), run);
+	}
+
+	printf("baseline per pixel loop      %6.1f ns/scanline\n", baseline);
+	printf("monochrome table (user-001)  %6.1f ns/scanline (x%.2f)\n", mono, baseline / mono);
+	printf("RenderTextScanlineBuf        %6.1f ns/scanline (x%.2f)\n", plain, baseline / plain);
+	printf("  every cell its own colours %6.1f ns/scanline (x%.2f)\n", colorful, baseline / colorful);
+	return bad != 0;
+}
+
+// render_bench.c
@@ -0,0 +1,168 @@
+// ----------------------------------------------------------------------------
+// streaming file reader: SR_Gets() from sdreader.c against splitting the same
+// file in memory, for line buffers of many sizes. The files mix LF, CR LF and
+// lone CRs, with CRs and CR LF pairs put right on the SR_BUFFER_SIZE chunk
+// boundaries, and lines of exactly the buffer size. SR_Read() and
+// SR_LuaReader() have to give back the file as it is
+// ----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdcard.h"
+#include "sdreader.h"
+
+#define FILE_SIZE (3 * SR_BUFFER_SIZE + 1000)
+#define FILES 200
+
+static uint8_t file[FILE_SIZE];
+static UINT file_size;
+static int checks, bad;
+
+FRESULT SD_Mount() {
+	return FR_OK;
+}
+
+FRESULT f_open(FIL *fp, const char *path, BYTE mode) {
+	(void)path;
+	(void)mode;
+	fp->obj.fs = fp;
+	fp->data = file;
+	fp->size = file_size;
+	fp->pos = 0;
+	return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+	fp->obj.fs = NULL;
+	return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buf, UINT btr, UINT *br) {
+	UINT n = fp->size - fp->pos < btr ? fp->size - fp->pos : btr;
+	memcpy(buf, fp->data + fp->pos, n);
+	fp->pos += n;
+	*br = n;
+	return FR_OK;
+}
+
+// random lines; every chunk boundary gets a line end or a lone CR right on it
+static void _MakeFile(unsigned seed) {
+	srand(seed);
+	file_size = FILE_SIZE - rand() % 2000;
+	for (UINT i = 0; i < file_size; i++) {
+		int r = rand() % 40;
+		file[i] = r == 0 ? '\n' : r == 1 ? '\r' : 'a' + r % 26;
+	}
+	for (UINT b = SR_BUFFER_SIZE; b < file_size; b += SR_BUFFER_SIZE) {
+		// a 40 character line right before the boundary: a full buffer of 41
+		// ends there
+		file[b - 42] = '\n';
+		memset(file + b - 41, 'f', 40);
+		switch (seed % 4) {
+		case 0: file[b - 1] = '\r'; file[b] = 'x'; break;			// a lone CR ends the chunk
+		case 1: file[b - 1] = '\r'; file[b] = '\n'; break;			// CR LF across it
+		case 2: file[b - 1] = '\n'; break;
+		case 3: file[b - 2] = '\r'; file[b - 1] = '\n'; break;
+		}
+	}
+}
+
+// what SR_Gets() has to return: lines split at LF, one CR before it dropped,
+// then cut into pieces of size - 1 (a line of exactly that length is one piece)
+static bool _Expect(UINT *pos, char *piece, int size, int *left) {
+	static UINT start, end;
+	static int offs;
+	if (!*left) {
+		if (*pos >= file_size)
+			return false;
+		start = *pos;
+		end = start;
+		while (end < file_size && file[end] != '\n')
+			end++;
+		*pos = end < file_size ? end + 1 : end;
+		if (end < file_size && end > start && file[end - 1] == '\r')
+			end--;
+		*left = end - start ? end - start : -1;		// -1: an empty line
+		offs = 0;
+	}
+	int n = *left < 0 ? 0 : *left < size - 1 ? *left : size - 1;
+	memcpy(piece, file + start + offs, n);
+	piece[n] = 0;
+	offs += n;
+	*left = *left < 0 ? 0 : *left - n;
+	return true;
+}
+
+static void _CheckLines(unsigned seed, int size) {
+	struct SDReader r;
+	char *got = malloc(size), *want = malloc(size);
+	UINT pos = 0;
+	int left = 0, line = 0;
+
+	SR_Open(&r, "test");
+	for (;; line++) {
+		int n = SR_Gets(&r, got, size);
+		bool more = _Expect(&pos, want, size, &left);
+		checks++;
+		if (n < 0 && !more)
+			break;
+		if (n < 0 || !more || n != (int)strlen(want) || memcmp(got, want, n + 1)) {
+			if (++bad <= 10)
+				printf("file %u, buffer %d, line %d: got %d [%s], want %s[%s]\n", seed, size, line,
+					n, n < 0 ? "" : got, more ? "" : "the end ", more ? want : "");
+			break;
+		}
+	}
+	SR_Close(&r);
+	free(got);
+	free(want);
+}
+
+static void _CheckBlocks(unsigned seed, size_t block) {
+	struct SDReader r;
+	static uint8_t copy[FILE_SIZE + 1];
+	size_t total = 0, n;
+
+	SR_Open(&r, "test");
+	while ((n = SR_Read(&r, copy + total, total + block <= FILE_SIZE ? block : FILE_SIZE + 1 - total)))
+		total += n;
+	SR_Close(&r);
+	checks++;
+	if (total != file_size || memcmp(copy, file, total)) {
+		if (++bad <= 10)
+			printf("file %u, SR_Read of %zu: %zu bytes back\n", seed, block, total);
+	}
+
+	SR_Open(&r, "test");
+	const char *p;
+	total = 0;
+	while ((p = SR_LuaReader(NULL, &r, &n)) && total + n <= FILE_SIZE) {
+		memcpy(copy + total, p, n);
+		total += n;
+	}
+	SR_Close(&r);
+	checks++;
+	if (total != file_size || memcmp(copy, file, total)) {
+		if (++bad <= 10)
+			printf("file %u, SR_LuaReader: %zu bytes back\n", seed, total);
+	}
+}
+
+int main() {
+	static const int sizes[] = { 2, 3, 4, 5, 8, 17, 40, 41, 81, 256, 512 };
+
+	for (unsigned seed = 0; seed < FILES; seed++) {
+		_MakeFile(seed);
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			_CheckLines(seed, sizes[i]);
+		_CheckBlocks(seed, 1 + seed % 700);
+	}
+	printf("%d checks, %d wrong\n", checks, bad);
+	return bad != 0;
+}
+
+// sdreader_test.c
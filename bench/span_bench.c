@@ -0,0 +1,167 @@
+// ----------------------------------------------------------------------------
+// console span writer: Con_fputs() from conio.c against writing the same text
+// one ConWriteCharacter() at a time (what Con_fputs did before user-010).
+// Random text with BS, CR and LF has to leave the same screen, cursor and
+// scrollback behind in 40 and 80 columns, then a few typical workloads get
+// timed in characters per second
+// ----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "display.h"
+#include "conio.h"
+#include "scrollback.h"
+
+void ConWriteCharacter(int c);		// conio.c, not in conio.h
+
+#define TRIALS 2000
+#define REPEAT 50
+#define RUNS 5
+
+static uint8_t snapshot[3 * 30 * 80];
+static char listing[2000 * 40];
+static char longline[20000];
+
+static void _PerCharacter(const char *p) {
+	while (*p)
+		ConWriteCharacter(*p++);
+}
+
+static void _Span(const char *p) {
+	Con_fputs(p, stdout);
+}
+
+// FNV-1a over everything the writer touches
+static uint64_t _Hash() {
+	uint64_t h = 1469598103934665603ull;
+	DisplaySaveScreen(snapshot);
+	for (size_t i = 0; i < DisplayScreenBytes(); i++) {
+		h ^= snapshot[i];
+		h *= 1099511628211ull;
+	}
+	h ^= ConGetCursorRow() * 131 + ConGetCursorColumn();
+	h ^= (uint64_t)SB_GetLineCount() * 7919;
+	return h;
+}
+
+static void _Reset(int row, int col) {
+	ClearTextDisplay();
+	SB_Clear();
+	ConSetCursorPos(row, col);
+}
+
+static double _Now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// a directory listing written one line per call
+static long _Lines(void (*write)(const char *p)) {
+	long chars = 0;
+	for (const char *p = listing; *p; ) {
+		char line[64];
+		int n = strchr(p, '\n') + 1 - p;
+		memcpy(line, p, n);
+		line[n] = 0;
+		write(line);
+		chars += n;
+		p += n;
+	}
+	return chars;
+}
+
+// the same listing in one call
+static long _Listing(void (*write)(const char *p)) {
+	write(listing);
+	return strlen(listing);
+}
+
+// a print loop of short lines
+static long _Short(void (*write)(const char *p)) {
+	for (int i = 0; i < 2000; i++)
+		write("hello\n");
+	return 2000 * 6;
+}
+
+// one string wrapping over many rows
+static long _Long(void (*write)(const char *p)) {
+	write(longline);
+	return sizeof(longline) - 1;
+}
+
+// Mchars/s, best of RUNS
+static double _Time(long (*workload)(void (*write)(const char *p)), void (*write)(const char *p)) {
+	double best = 0;
+	for (int run = 0; run < RUNS; run++) {
+		_Reset(0, 0);
+		long chars = 0;
+		double t = _Now();
+		for (int n = 0; n < REPEAT; n++)
+			chars += workload(write);
+		double rate = chars / (_Now() - t) / 1e6;
+		if (rate > best)
+			best = rate;
+	}
+	return best;
+}
+
+int main() {
+	int bad = 0;
+
+	DisplayOpen();
+	ConOpen();
+
+	srand(1);
+	for (int trial = 0; trial < TRIALS; trial++) {
+		char s[400];
+		int n = rand() % (sizeof(s) - 1);
+		for (int i = 0; i < n; i++) {
+			int r = rand() % 20;
+			s[i] = r == 0 ? '\n' : r == 1 ? '\r' : r == 2 ? 8 : 'a' + rand() % 26;
+		}
+		s[n] = 0;
+
+		D_MODE = &DISPLAY_MODES[trial & 1 ? D_MODE_TEXT80 : D_MODE_TEXT];
+		int row = rand() % D_CHAR_ROWS;
+		int col = rand() % D_CHAR_COLS;
+		_Reset(row, col);
+		_PerCharacter(s);
+		uint64_t h = _Hash();
+		_Reset(row, col);
+		_Span(s);
+		if (_Hash() != h)
+			bad++;
+	}
+	printf("strings written differently: %d\n", bad);
+
+	D_MODE = &DISPLAY_MODES[D_MODE_TEXT];
+	char *p = listing;
+	for (int i = 0; i < 2000; i++)
+		p += sprintf(p, "FILE%04d.TXT      %8d\n", i, i * 37);
+	for (size_t i = 0; i < sizeof(longline) - 1; i++)
+		longline[i] = 'A' + i % 26;
+
+	static const struct {
+		const char *name;
+		long (*workload)(void (*write)(const char *p));
+	} workloads[] = {
+		{ "dir listing, a line per call", _Lines },
+		{ "dir listing in one call",      _Listing },
+		{ "short lines",                  _Short },
+		{ "long wrapping string",         _Long },
+	};
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		double old = _Time(workloads[i].workload, _PerCharacter);
+		double span = _Time(workloads[i].workload, _Span);
+		printf("%-30s per character %6.1f  span %6.1f Mchars/s (x%.2f)\n",
+			workloads[i].name, old, span, span / old);
+	}
+	return bad != 0;
+}
+
+// span_bench.c
@@ -0,0 +1,549 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cformat.h"
+
+// the output goes into buf, which is either the chunk or (CF_vsnprintf()) the
+// caller's buffer itself: then there is no copy, and once it is full the emit
+// function switches over to the chunk and drops the rest
+struct Out {
+	CF_Emit emit;
+	void *ctx;
+	char *buf;
+	int size;			// of buf
+	int n;				// bytes in buf
+	int total;			// bytes produced so far
+	char chunk[CF_CHUNK_SIZE];
+};
+
+static void _Flush(struct Out *o) {
+	if (o->n) {
+		o->emit(o->ctx, o->buf, o->n);
+		o->n = 0;
+	}
+}
+
+static inline void _Put(struct Out *o, char c) {
+	o->buf[o->n++] = c;
+	o->total++;
+	if (o->n == o->size)
+		_Flush(o);
+}
+
+static void __attribute__((noinline)) _PutLong(struct Out *o, const char *s, int n) {
+	while (n > o->size - o->n) {
+		if (o->buf == o->chunk) {
+			// does not fit: pass it on directly
+			_Flush(o);
+			o->emit(o->ctx, s, n);
+			return;
+		}
+		int k = o->size - o->n;
+		memcpy(o->buf + o->n, s, k);
+		o->n += k;
+		s += k;
+		n -= k;
+		_Flush(o);
+	}
+	memcpy(o->buf + o->n, s, n);
+	o->n += n;
+	if (o->n == o->size)
+		_Flush(o);
+}
+
+// short runs that fit (the usual case) are copied a byte at a time
+static inline void _PutN(struct Out *o, const char *s, int n) {
+	o->total += n;
+	if (n > CF_CHUNK_SIZE || n >= o->size - o->n) {
+		_PutLong(o, s, n);
+		return;
+	}
+	char *d = o->buf + o->n;
+	o->n += n;
+	while (n--)
+		*d++ = *s++;
+}
+
+static void _Pad(struct Out *o, char c, int n) {
+	o->total += n;
+	while (n > 0) {
+		int k = o->size - o->n < n ? o->size - o->n : n;
+		memset(o->buf + o->n, c, k);
+		o->n += k;
+		n -= k;
+		if (o->n == o->size)
+			_Flush(o);
+	}
+}
+
+#define F_LEFT	0x01
+#define F_ZERO	0x02
+#define F_PLUS	0x04
+#define F_SPACE	0x08
+#define F_ALT	0x10
+
+// writes digits of v in base (8, 10 or 16) backwards from end, returns the digit count
+// 32 bit values take the 32 bit division path (no 64 bit division on the M0+)
+static int _Digits(char *end, unsigned long long v, int base, int upper) {
+	const char *xdigits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *p = end;
+	if (base == 16) {
+		do { *--p = xdigits[v & 15]; v >>= 4; } while (v);
+	} else if (base == 8) {
+		do { *--p = '0' + (v & 7); v >>= 3; } while (v);
+	} else if (v <= UINT32_MAX) {
+		uint32_t w = v;
+		do { *--p = '0' + w % 10; w /= 10; } while (w);
+	} else {
+		do { *--p = '0' + v % 10; v /= 10; } while (v);
+	}
+	return end - p;
+}
+
+// emit a number field: prefix (sign, 0x), zero fill up to precision, digits and
+// padding up to width
+static void _Field(struct Out *o, const char *prefix, const char *digits, int ndigits,
+	int flags, int width, int precision) {
+
+	int plen = strlen(prefix);
+	int zeros = precision > ndigits ? precision - ndigits : 0;
+	int len = plen + zeros + ndigits;
+	int pad = width > len ? width - len : 0;
+
+	if (!(flags & F_LEFT)) {
+		if ((flags & F_ZERO) && precision < 0) {
+			zeros += pad;
+		} else {
+			_Pad(o, ' ', pad);
+		}
+		pad = 0;
+	}
+	if (plen)
+		_PutN(o, prefix, plen);
+	if (zeros)
+		_Pad(o, '0', zeros);
+	_PutN(o, digits, ndigits);
+	if (pad)
+		_Pad(o, ' ', pad);
+}
+
+static const uint32_t pow10[10] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// values this big or precise do not fit the fast path of _Float()
+#define FLOAT_FAST_MAX 18446744073709551616.0	// 2^64
+#define FLOAT_FAST_DECIMALS 9
+
+#define BIG_WORDS 36		// 1074 fraction bits or 1024 integer bits, 32 per word, plus room for m
+
+// m * 2^shift into big number words (little endian), m has at most 53 bits
+static void _BigSet(uint32_t *big, int nw, uint64_t m, int shift) {
+	memset(big, 0, nw * sizeof(uint32_t));
+	int w = shift / 32;
+	uint64_t t = (uint64_t)(uint32_t)m << (shift % 32);
+	big[w] = t;
+	t = ((m >> 32) << (shift % 32)) | (t >> 32);
+	big[w + 1] = t;
+	big[w + 2] = t >> 32;
+}
+
+// the next fraction digit: the fraction (nw words, a binary point above the
+// top one) times ten, the digit is what gets carried out
+static int _BigFracDigit(uint32_t *big, int nw) {
+	uint32_t carry = 0;
+	for (int i = 0; i < nw; i++) {
+		uint64_t t = (uint64_t)big[i] * 10 + carry;
+		big[i] = t;
+		carry = t >> 32;
+	}
+	return carry;
+}
+
+// %f the long way: exact for every finite value and any precision. The bits of
+// the double are expanded from big numbers, the integer part by dividing it
+// down by 10^9, the fraction by multiplying it up by 10 (twice: the first pass
+// finds out where rounding up stops, the second one writes the digits).
+// Uses about 300 bytes of stack, kept out of _Float() so the fast path does not
+// pay for it
+static void __attribute__((noinline)) _FloatExact(struct Out *o, double v, const char *prefix,
+	int flags, int width, int precision) {
+
+	uint32_t big[BIG_WORDS];
+	uint32_t chunks[BIG_WORDS];		// integer part in 9 digit chunks, least significant first
+	int nchunks = 0;
+	unsigned long long ip = 0;
+	int nw = 0;						// fraction words
+
+	union { double d; uint64_t u; } bits = { v };
+	int be = (bits.u >> 52) & 0x7ff;
+	uint64_t m = bits.u & ((1ull << 52) - 1);
+	if (be)
+		m |= 1ull << 52;
+	else
+		be = 1;
+	int e = be - 1075;				// v = m * 2^e
+
+	if (e >= 0) {
+		// an integer, possibly a huge one
+		int n = e / 32 + 3;
+		_BigSet(big, n, m, e);
+		while (n && !big[n - 1])
+			n--;
+		while (n) {
+			uint64_t rem = 0;
+			for (int i = n - 1; i >= 0; i--) {
+				uint64_t t = rem << 32 | big[i];
+				big[i] = t / 1000000000u;
+				rem = t % 1000000000u;
+			}
+			chunks[nchunks++] = rem;
+			while (n && !big[n - 1])
+				n--;
+		}
+	} else {
+		int k = -e;					// fraction bits
+		uint64_t f = k < 64 ? m & ((1ull << k) - 1) : m;
+		ip = k < 64 ? m >> k : 0;
+		nw = (k + 31) / 32;
+		_BigSet(big, nw + 2, f, nw * 32 - k);
+	}
+
+	// pass 1: round up if what is left after precision digits is half or more,
+	// the carry ripples back over trailing nines
+	int last = -1;					// last digit that is not a 9
+	bool up = false;
+	if (nw) {
+		for (int i = 0; i < precision; i++)
+			if (_BigFracDigit(big, nw) != 9)
+				last = i;
+		up = big[nw - 1] >> 31;
+		if (up && last < 0)
+			ip++;					// the fraction is all nines (v < 2^53 here)
+	}
+
+	char tmp[24];
+	char *end = tmp + sizeof(tmp);
+	int top = nchunks ? _Digits(end, chunks[nchunks - 1], 10, 0) : _Digits(end, ip, 10, 0);
+	int nint = top + 9 * (nchunks ? nchunks - 1 : 0);
+	int plen = strlen(prefix);
+	int len = plen + nint + (precision || (flags & F_ALT) ? 1 : 0) + precision;
+	int pad = width > len ? width - len : 0;
+
+	if (!(flags & F_LEFT) && !(flags & F_ZERO))
+		_Pad(o, ' ', pad);
+	_PutN(o, prefix, plen);
+	if (!(flags & F_LEFT) && (flags & F_ZERO))
+		_Pad(o, '0', pad);
+	_PutN(o, end - top, top);
+	for (int c = nchunks - 2; c >= 0; c--) {
+		char *p = end;
+		uint32_t w = chunks[c];
+		for (int i = 0; i < 9; i++) {
+			*--p = '0' + w % 10;
+			w /= 10;
+		}
+		_PutN(o, p, 9);
+	}
+	if (precision || (flags & F_ALT))
+		_Put(o, '.');
+
+	// pass 2: the digits
+	if (nw)
+		_BigSet(big, nw + 2, e > -64 ? m & ((1ull << -e) - 1) : m, nw * 32 + e);
+	for (int i = 0; i < precision; i++) {
+		int d = nw ? _BigFracDigit(big, nw) : 0;
+		if (up && i >= last)
+			d = i == last ? d + 1 : 0;
+		_Put(o, '0' + d);
+	}
+	if (flags & F_LEFT)
+		_Pad(o, ' ', pad);
+}
+
+// %f: integer and fraction part converted separately, up to 9 decimals and 2^64
+// (anything else takes _FloatExact())
+static void _Float(struct Out *o, double v, int flags, int width, int precision) {
+	char tmp[32];
+	char *end = tmp + sizeof(tmp);
+	const char *prefix = "";
+
+	if (precision < 0) precision = 6;
+
+	if (v < 0 || (v == 0 && 1 / v < 0)) {
+		prefix = "-";
+		v = -v;
+	} else if (flags & F_PLUS) {
+		prefix = "+";
+	} else if (flags & F_SPACE) {
+		prefix = " ";
+	}
+
+	if (v - v != 0) {
+		// nan or inf
+		_Field(o, prefix, v != v ? "nan" : "inf", 3, flags & ~F_ZERO, width, -1);
+		return;
+	}
+	if (v >= FLOAT_FAST_MAX || precision > FLOAT_FAST_DECIMALS) {
+		_FloatExact(o, v, prefix, flags, width, precision);
+		return;
+	}
+
+	unsigned long long ip = (unsigned long long)v;
+	uint32_t scale = pow10[precision];
+	double f = (v - (double)ip) * scale + 0.5;
+	uint32_t frac = (uint32_t)f;
+	if (frac >= scale) {
+		frac -= scale;
+		ip++;
+	}
+
+	char *p = end;
+	if (precision) {
+		for (int i = 0; i < precision; i++) {
+			*--p = '0' + frac % 10;
+			frac /= 10;
+		}
+		*--p = '.';
+	} else if (flags & F_ALT) {
+		*--p = '.';
+	}
+	p -= _Digits(p, ip, 10, 0);
+	_Field(o, prefix, p, end - p, flags, width, -1);
+}
+
+static int _Format(struct Out *o, const char *format, va_list ap);
+
+int CF_vformat(CF_Emit emit, void *ctx, const char *format, va_list ap) {
+	struct Out o;
+	o.emit = emit;
+	o.ctx = ctx;
+	o.buf = o.chunk;
+	o.size = CF_CHUNK_SIZE;
+	o.n = o.total = 0;
+	return _Format(&o, format, ap);
+}
+
+static int _Format(struct Out *o, const char *format, va_list ap) {
+	const char *f = format;
+	while (*f) {
+		// literal run
+		const char *lit = f;
+		while (*f && *f != '%')
+			f++;
+		if (f > lit)
+			_PutN(o, lit, f - lit);
+		if (!*f)
+			break;
+		f++;	// '%'
+
+		int flags = 0;
+		for (;; f++) {
+			if (*f == '-') flags |= F_LEFT;
+			else if (*f == '0') flags |= F_ZERO;
+			else if (*f == '+') flags |= F_PLUS;
+			else if (*f == ' ') flags |= F_SPACE;
+			else if (*f == '#') flags |= F_ALT;
+			else break;
+		}
+
+		int width = 0;
+		if (*f == '*') {
+			width = va_arg(ap, int);
+			if (width < 0) {
+				flags |= F_LEFT;
+				width = -width;
+			}
+			f++;
+		} else {
+			while (*f >= '0' && *f <= '9')
+				width = width * 10 + (*f++ - '0');
+		}
+
+		int precision = -1;
+		if (*f == '.') {
+			f++;
+			precision = 0;
+			if (*f == '*') {
+				precision = va_arg(ap, int);
+				f++;
+			} else {
+				while (*f >= '0' && *f <= '9')
+					precision = precision * 10 + (*f++ - '0');
+			}
+		}
+
+		// length modifier: 0 int, 1 long, 2 long long, -1 short, -2 char, 3 size_t/intmax_t/ptrdiff_t
+		int length = 0;
+		switch (*f) {
+		case 'h':
+			length = -1;
+			if (*++f == 'h') { length = -2; f++; }
+			break;
+		case 'l':
+			length = 1;
+			if (*++f == 'l') { length = 2; f++; }
+			break;
+		case 'z':
+		case 't':
+			length = (sizeof(size_t) == sizeof(long long)) ? 2 : 1;
+			f++;
+			break;
+		case 'j':
+			length = 2;
+			f++;
+			break;
+		}
+
+		char tmp[24];
+		char *end = tmp + sizeof(tmp);
+		char conv = *f;
+		if (!conv)
+			break;
+		f++;
+
+		switch (conv) {
+		case 'd':
+		case 'i': {
+			long long v;
+			if (length == 2) v = va_arg(ap, long long);
+			else if (length == 1) v = va_arg(ap, long);
+			else v = va_arg(ap, int);
+			if (length == -1) v = (short)v;
+			else if (length == -2) v = (signed char)v;
+
+			const char *prefix = "";
+			unsigned long long u = v;
+			if (v < 0) {
+				prefix = "-";
+				u = -u;
+			} else if (flags & F_PLUS) {
+				prefix = "+";
+			} else if (flags & F_SPACE) {
+				prefix = " ";
+			}
+			int nd = (precision == 0 && u == 0) ? 0 : _Digits(end, u, 10, 0);
+			_Field(o, prefix, end - nd, nd, flags, width, precision);
+			break;
+		}
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o': {
+			unsigned long long u;
+			if (length == 2) u = va_arg(ap, unsigned long long);
+			else if (length == 1) u = va_arg(ap, unsigned long);
+			else u = va_arg(ap, unsigned int);
+			if (length == -1) u = (unsigned short)u;
+			else if (length == -2) u = (unsigned char)u;
+
+			int base = (conv == 'u') ? 10 : (conv == 'o') ? 8 : 16;
+			int nd = (precision == 0 && u == 0) ? 0 : _Digits(end, u, base, conv == 'X');
+			const char *prefix = "";
+			if (flags & F_ALT) {
+				if (conv == 'x' && u) prefix = "0x";
+				else if (conv == 'X' && u) prefix = "0X";
+				else if (conv == 'o' && precision <= nd && !(u == 0 && nd)) prefix = "0";	// leading 0 only if there is none yet
+			}
+			_Field(o, prefix, end - nd, nd, flags, width, precision);
+			break;
+		}
+		case 'p': {
+			uintptr_t u = (uintptr_t)va_arg(ap, void*);
+			int nd = _Digits(end, u, 16, 0);
+			_Field(o, "0x", end - nd, nd, flags & ~F_ZERO, width, -1);
+			break;
+		}
+		case 'c':
+			tmp[0] = (char)va_arg(ap, int);
+			_Field(o, "", tmp, 1, flags & ~F_ZERO, width, -1);
+			break;
+		case 's': {
+			const char *s = va_arg(ap, const char*);
+			if (!s)
+				s = "(null)";
+			int len = 0;
+			while (s[len] && (precision < 0 || len < precision))
+				len++;
+			_Field(o, "", s, len, flags & ~F_ZERO, width, -1);
+			break;
+		}
+		case 'f':
+		case 'F':
+			_Float(o, va_arg(ap, double), flags, width, precision);
+			break;
+		case '%':
+			_Put(o, '%');
+			break;
+		default:
+			// unknown conversion: pass it through
+			_Put(o, '%');
+			_Put(o, conv);
+		}
+	}
+
+	_Flush(o);
+	return o->total;
+}
+
+// ----------------------------------------------------------------------------
+// FILE* AND BUFFER VARIANTS
+// ----------------------------------------------------------------------------
+
+static void _FileEmit(void *ctx, const char *s, int n) {
+	fwrite(s, 1, n, (FILE*)ctx);
+}
+
+int CF_vfprintf(FILE *stream, const char *format, va_list ap) {
+	return CF_vformat(_FileEmit, stream, format, ap);
+}
+
+int CF_fprintf(FILE *stream, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int n = CF_vfprintf(stream, format, ap);
+	va_end(ap);
+	return n;
+}
+
+static void _Drop(void *ctx, const char *s, int n) {
+}
+
+// the caller's buffer is full (the output is in place already): what follows
+// only gets counted
+static void _BufFull(void *ctx, const char *s, int n) {
+	struct Out *o = ctx;
+	o->emit = _Drop;
+	o->buf = o->chunk;
+	o->size = CF_CHUNK_SIZE;
+}
+
+int CF_vsnprintf(char *buf, size_t size, const char *format, va_list ap) {
+	struct Out o;
+	o.ctx = &o;
+	o.n = o.total = 0;
+	if (size > 1) {
+		o.emit = _BufFull;
+		o.buf = buf;
+		o.size = size - 1 < INT32_MAX ? size - 1 : INT32_MAX;		// room for the terminator
+	} else {
+		o.emit = _Drop;
+		o.buf = o.chunk;
+		o.size = CF_CHUNK_SIZE;
+	}
+	int n = _Format(&o, format, ap);
+	if (size)
+		buf[(size_t)n < size - 1 ? (size_t)n : size - 1] = 0;
+	return n;
+}
+
+int CF_snprintf(char *buf, size_t size, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int n = CF_vsnprintf(buf, size, format, ap);
+	va_end(ap);
+	return n;
+}
+
+// cformat.c
@@ -0,0 +1,38 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * COMPACT FORMATTED OUTPUT
+ * a small printf style formatter that streams its output in chunks
+ * to an emit function instead of staging it in a buffer
+ *
+ * conversions: d i u x X o c s p % and f (fixed point, any value and precision,
+ *   halves round up; from 2^64 or 10 decimals on an exact but slower path takes
+ *   over, with about 300 more bytes of stack)
+ * flags: - 0 + space #, width and precision (also as *)
+ * length modifiers: hh h l ll z j t
+ * ------------------------------------------------------*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// output chunk size (stack use of a format call is about this plus 64 bytes)
+#ifndef CF_CHUNK_SIZE
+#define CF_CHUNK_SIZE 32
+#endif
+
+// receives the formatted output in chunks of up to CF_CHUNK_SIZE bytes
+// (strings may get passed on in one go)
+typedef void (*CF_Emit)(void *ctx, const char *s, int n);
+
+int CF_vformat(CF_Emit emit, void *ctx, const char *format, va_list ap);
+
+// FILE* backed variants (for instance for files on the sd card)
+int CF_vfprintf(FILE *stream, const char *format, va_list ap);
+int CF_fprintf(FILE *stream, const char *format, ...);
+
+// buffer variants: like vsnprintf() they return the untruncated length
+int CF_vsnprintf(char *buf, size_t size, const char *format, va_list ap);
+int CF_snprintf(char *buf, size_t size, const char *format, ...);
+
+// cformat.h
@@ -2,22 +2,61 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "display.h"
 #include "conio.h"
 #include "cstream.h"
+#include "input.h"
+#include "scrollback.h"
+#include "cformat.h"
+#include "uartcon.h"
+
+
+#define CON_ESC_PARAMS 8				// CSI parameters kept, further ones are ignored
+
+// per virtual console state: every console writes to its own character screen
+// (display.c) and reads from its own input stream
+struct Console {
+	struct CharacterStream in;
+	int row, col;					// cursor row & col (character modes)
+	unsigned char echo;				// echo is on by default
+	unsigned char cursor_enabled;
+
+	// escape sequence parser (see _Escape())
+	unsigned char esc;				// ESC_xxx parser state
+	unsigned char priv;				// private marker of a CSI sequence ('?')
+	unsigned char nparams;
+	unsigned short params[CON_ESC_PARAMS];
+	unsigned char attr;				// SGR attributes: D_ATTR_xxx and CON_ATTR_BOLD
+	unsigned char fg, bg;			// SGR colours: the pen is these with bold applied (see _Sgr())
+	unsigned char attr_used;		// once SGR attributes were used writes set the attribute bytes
+	unsigned char region;			// a scroll region other than the whole screen is set
+	int top, bottom;				// scroll region rows (inclusive)
+	int saved_row, saved_col;		// ESC 7, CSI s
+
+	// report to read latency probe: one key press at a time is followed from its
+	// keyboard report to where the console reads it (see _ReadInput())
+	uint64_t probe_us;				// when the report arrived
+	uint32_t probe_pos;				// input stream index of its character
+	unsigned char probing;			// set by the producer, cleared by the reader
+};
 
+#define ESC_NONE	0
+#define ESC_START	1				// ESC seen
+#define ESC_CSI		2				// ESC [ seen: collecting parameters
 
-static struct CharacterStream CSTDIN;
+#define CON_ATTR_BOLD	0x80
+#define CON_ATTR_CELL	(D_ATTR_INVERSE | D_ATTR_FLASH)	// the SGR attributes that go into cells
 
-// CURSOR ROW & COL (character modes)
-static int CROW = 0;
-static int CCOL = 0;
+static struct Console consoles[CON_COUNT];
+static struct Console *con = &consoles[0];		// output goes here, input is read from here
+static struct Console *shown = &consoles[0];	// the console on the display
+static struct Console *volatile keyboard = &consoles[0];	// keyboard (and uart) input goes here
+static unsigned char con_open[CON_COUNT];		// the console's screen has been allocated
 
-static unsigned char CON_ECHO = 1;	// echo is on by default
 static int IMPLICIT_CR = 1;			// enable impicit CR (on LF) by default
 static int IMPLICIT_LF = 1;			// enable impicit LF (on CR) by default
-static unsigned char cursor_enabled = 1;
 
 
 /* --------------------------------------------------------------------------*
@@ -28,49 +67,53 @@ static unsigned char cursor_enabled = 1;
 //static int cursor_on = 0;
 
 void DrawCursor() {
-    if(cursor_enabled)
-        SetAttribute(D_ATTR_FLASH, CROW, CCOL);
+    if(con->cursor_enabled)
+        SetAttribute(D_ATTR_FLASH, con->row, con->col);
 }
 void UnDrawCursor() {
-    if(cursor_enabled)
-        UnSetAttribute(D_ATTR_FLASH, CROW, CCOL);
+    if(con->cursor_enabled)
+        UnSetAttribute(D_ATTR_FLASH, con->row, con->col);
 }
 
 void ConCursorOff() {
 	UnDrawCursor();
-	cursor_enabled = 0;
+	con->cursor_enabled = 0;
 }
 
 void ConCursorOn() {
-	cursor_enabled = 1;
+	con->cursor_enabled = 1;
 	DrawCursor();
 }
 
 
 int ConGetCursorRow() {
-	return CROW;
+	return con->row;
 }
 
 int ConGetCursorColumn() {
-	return CCOL;
+	return con->col;
 }
 
 void ConGetCursorPos(int *row, int *col) {
-	*row = CROW;
-	*col = CCOL;
+	*row = con->row;
+	*col = con->col;
 }
 
 void ConSetCursorPos(int row, int col) {
 	UnDrawCursor();
-	CROW = row;
-	CCOL = col;
+	con->row = row;
+	con->col = col;
 	DrawCursor();
+	if (con == shown)
+		UC_CursorTo(row, col);
 }
 
 void ConClearCursorRow() {
+	if (con == shown)
+		UC_ClearRow();
 	ConCursorOff();
 	for (int column = 0; column < D_CHAR_COLS; column++) {
-		PutCharacter(' ', CROW, column);
+		PutCharacter(' ', con->row, column);
 	}
 	ConCursorOn();
 }
@@ -78,18 +121,18 @@ void ConClearCursorRow() {
 
 // Move Cursor UP
 void ConCursorUp() {
-	if (CROW > 0) {
+	if (con->row > 0) {
 		UnDrawCursor();
-		CROW--;
+		con->row--;
 		DrawCursor();
 	}
 }
 
 // Move Cursor DOWN
 void ConCursorDown() {
-	if (CROW < D_CHAR_ROWS - 1) {
+	if (con->row < D_CHAR_ROWS - 1) {
 		UnDrawCursor();
-		CROW++;
+		con->row++;
 		DrawCursor();
 	}
 }
@@ -97,93 +140,319 @@ void ConCursorDown() {
 // moves the cursor left if possible
 // does not clear what is "under the cursor" (as opposed to CursorBackspace())
 void ConCursorLeft() {
-	if (CCOL > 0) {
+	if (con->col > 0) {
 		UnDrawCursor();
-		CCOL--;
+		con->col--;
 		DrawCursor();
 	}
 }
 // no auto-wrap into the next line
 void ConCursorRight() {
-	if (CCOL < D_CHAR_COLS - 1) {
+	if (con->col < D_CHAR_COLS - 1) {
 		UnDrawCursor();
-		CCOL++;
+		con->col++;
 		DrawCursor();
 	}
 }
 
 /* --------------------------------------------------------------------------*
- * CHARACTER OUTPUT                                                          *
+ * COLOURS                                                                   *
  * --------------------------------------------------------------------------*/
 
-// FIXME: obsolete
-// call this direcly if you already have a cursor lock
-static void _AdvanceRowInner() {
-	CROW++;
-	if (CROW == D_CHAR_ROWS) {
-        // FIXME: implement
-		CharacterDisplayScrollUp();
-		CROW--;
-	}
+// the colours are taken as they are: bold no longer brightens them
+void Con_SetColor(int fg, int bg) {
+	con->fg = fg & 0x0f;
+	con->bg = bg & 0x0f;
+	con->attr &= ~CON_ATTR_BOLD;
+	SetPenColor(D_COLORS(fg, bg));
+	if (con == shown)
+		UC_Color(fg, bg);
 }
 
-// automatically scrolls up
-static void _AdvanceRow() {
-    UnDrawCursor();
-	_AdvanceRowInner();
-    DrawCursor();
+void Con_GetColor(int *fg, int *bg) {
+	uint8_t color = GetPenColor();
+	*fg = color & 0x0f;
+	*bg = color >> 4;
 }
 
-// move the cursor right: automatically skips to next row when 
-// advancing past the right screen border
-static void _AdvanceCursor() {
-    UnDrawCursor();
-	CCOL++;
-	if (CCOL == D_CHAR_COLS) {
-		CCOL = 0;
-		_AdvanceRowInner();		// we already have the cursor locked
+/* --------------------------------------------------------------------------*
+ * CHARACTER OUTPUT                                                          *
+ * --------------------------------------------------------------------------*/
+
+#define CON_TAB_WIDTH 8			// tab stops every 8 columns (power of two)
+
+// top and bottom row the cursor scrolls within: the scroll region if one is set
+// (clamped in case the geometry shrank since)
+static inline int _RegionBottom() {
+	if (con->region && con->bottom < D_CHAR_ROWS)
+		return con->bottom;
+	return D_CHAR_ROWS - 1;
+}
+
+static inline int _RegionTop() {
+	if (con->region && con->top < _RegionBottom())
+		return con->top;
+	return 0;
+}
+
+// move the cursor down a row, scrolling if it is on the bottom row of the region
+// the whole screen scrolls with CharacterDisplayScrollUpLines(), which feeds the scrollback
+// all of these expect the cursor to be undrawn
+static void _LineFeed() {
+	int bottom = _RegionBottom();
+	if (con->row == bottom) {
+		int top = _RegionTop();
+		if (top == 0 && bottom == D_CHAR_ROWS - 1)
+			CharacterDisplayScrollUpLines(1);
+		else
+			CharacterDisplayScrollRegion(top, bottom, 1);
+	} else if (con->row < D_CHAR_ROWS - 1) {
+		con->row++;
 	}
-    DrawCursor();
 }
 
-static void _CarriageReturn() {
-    UnDrawCursor();
-	CCOL = 0;
-    DrawCursor();
+static void _ReverseLineFeed() {
+	int top = _RegionTop();
+	if (con->row == top)
+		CharacterDisplayScrollRegion(top, _RegionBottom(), -1);
+	else if (con->row > 0)
+		con->row--;
 }
 
-// backspacing up to the previous row not supported so far
-void _BackspaceCursor() {
-    UnDrawCursor();
-	CCOL--;
-	if (CCOL < 0) {
-		CCOL = 0;
-	}
-	// overwrite the current cursor position with a space: use the display driver
-	// api directly because we don't want to change the cursor position with this write
-	PutCharacter(' ', CROW, CCOL);
-    DrawCursor();
+// tabs never wrap: the last tab stop is the last column
+static inline int _NextTab(int col) {
+	col = (col + CON_TAB_WIDTH) & ~(CON_TAB_WIDTH - 1);
+	return col < D_CHAR_COLS ? col : D_CHAR_COLS - 1;
 }
 
-// write a character to the display at CROW, CCOL
-// handles \n \r and modifies CROW, CCOL accordingly
-// TODO: implement \b and \t (backspace and tab)
-void ConWriteCharacter(int c) {
+static void _Escape(int c);
+
+// write a character at con->row, con->col and move the cursor on (cursor undrawn)
+static void _PutChar(int c) {
+	if (con->esc) {
+		_Escape(c);
+		return;
+	}
 	switch (c) {
-	case 8:				// BACKSPACE
-		_BackspaceCursor();
+	case 27:			// ESC
+		con->esc = ESC_START;
+		break;
+	case 8:				// BACKSPACE: overwrites the previous column with a space
+		if (con->col > 0)
+			con->col--;
+		PutCharacter(' ', con->row, con->col);
+		break;
+	case 9:				// TAB
+		con->col = _NextTab(con->col);
 		break;
 	case 13:			// CR
-		_CarriageReturn();
-		if (IMPLICIT_LF) _AdvanceRow();
+		con->col = 0;
+		if (IMPLICIT_LF) _LineFeed();
 		break;
 	case 10:			// LF
-		_AdvanceRow();
-		if (IMPLICIT_CR) _CarriageReturn();
+		_LineFeed();
+		if (IMPLICIT_CR) con->col = 0;
 		break;
 	default:
-		PutCharacter(c, CROW, CCOL);
-		_AdvanceCursor();
+		PutCharacter(c, con->row, con->col);
+		if (con->attr_used)
+			FillAttributes(con->attr & CON_ATTR_CELL, con->row, con->col, 1);
+		if (++con->col == D_CHAR_COLS) {
+			con->col = 0;
+			_LineFeed();
+		}
+	}
+}
+
+// write a character to the display at con->row, con->col
+// handles BS, TAB, CR, LF and escape sequences and modifies con->row, con->col accordingly
+void ConWriteCharacter(int c) {
+	if (con == shown) {
+		char ch = c;
+		UC_Write(&ch, 1);		// mirrored to the uart bridge
+	}
+	UnDrawCursor();
+	_PutChar(c);
+	DrawCursor();
+}
+
+/* --------------------------------------------------------------------------*
+ * ESCAPE SEQUENCES                                                          *
+ * the common VT100/ANSI subset: ESC 7 8 D E M c and CSI sequences for       *
+ * cursor movement (A B C D E F G H d f s u), erasing (J K), scrolling       *
+ * (L M S T), the scroll region (r), colours and attributes (m) and cursor   *
+ * visibility (?25h ?25l). Anything else is swallowed                        *
+ * --------------------------------------------------------------------------*/
+
+// ANSI colour numbers (black red green yellow blue magenta cyan white) to palette indices
+static const uint8_t ansi_colors[8] = {
+	D_COLOR_BLACK, D_COLOR_RED, D_COLOR_GREEN, D_COLOR_BROWN,
+	D_COLOR_BLUE, D_COLOR_MAGENTA, D_COLOR_CYAN, D_COLOR_GREY
+};
+
+static inline int _Clamp(int v, int lo, int hi) {
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+// the pen is worked out from the SGR colours every time, so bold (a bright
+// foreground) can be switched off again
+static void _Sgr() {
+	int fg = con->fg;
+	int bg = con->bg;
+	for (int i = 0; i < con->nparams; i++) {
+		int p = con->params[i];
+		if (p == 0) {
+			con->attr = 0;
+			fg = D_COLOR_DEFAULT & 0x0f;
+			bg = D_COLOR_DEFAULT >> 4;
+		}
+		else if (p == 1) con->attr |= CON_ATTR_BOLD;
+		else if (p == 22) con->attr &= ~CON_ATTR_BOLD;
+		else if (p == 5) con->attr |= D_ATTR_FLASH;
+		else if (p == 25) con->attr &= ~D_ATTR_FLASH;
+		else if (p == 7) con->attr |= D_ATTR_INVERSE;
+		else if (p == 27) con->attr &= ~D_ATTR_INVERSE;
+		else if (p >= 30 && p <= 37) fg = ansi_colors[p - 30];
+		else if (p == 39) fg = D_COLOR_DEFAULT & 0x0f;
+		else if (p >= 40 && p <= 47) bg = ansi_colors[p - 40];
+		else if (p == 49) bg = D_COLOR_DEFAULT >> 4;
+		else if (p >= 90 && p <= 97) fg = ansi_colors[p - 90] | 8;
+		else if (p >= 100 && p <= 107) bg = ansi_colors[p - 100] | 8;
+	}
+	con->fg = fg;
+	con->bg = bg;
+	SetPenColor(D_COLORS((con->attr & CON_ATTR_BOLD) ? fg | 8 : fg, bg));
+	if (con->attr & CON_ATTR_CELL)
+		con->attr_used = 1;		// from now on writes set the attribute bytes
+}
+
+static void _Csi(int final) {
+	int rows = D_CHAR_ROWS;
+	int cols = D_CHAR_COLS;
+	int p0 = con->params[0];
+	int p1 = con->nparams > 1 ? con->params[1] : 0;
+	int n = p0 ? p0 : 1;		// count parameter (default 1)
+
+	if (con->priv) {
+		if (con->priv == '?' && p0 == 25 && (final == 'h' || final == 'l'))
+			con->cursor_enabled = (final == 'h');	// the cursor is undrawn right now
+		return;
+	}
+
+	switch (final) {
+	case 'A': con->row = _Clamp(con->row - n, 0, rows - 1); break;
+	case 'B': con->row = _Clamp(con->row + n, 0, rows - 1); break;
+	case 'C': con->col = _Clamp(con->col + n, 0, cols - 1); break;
+	case 'D': con->col = _Clamp(con->col - n, 0, cols - 1); break;
+	case 'E': con->row = _Clamp(con->row + n, 0, rows - 1); con->col = 0; break;
+	case 'F': con->row = _Clamp(con->row - n, 0, rows - 1); con->col = 0; break;
+	case 'G': con->col = _Clamp(n - 1, 0, cols - 1); break;
+	case 'd': con->row = _Clamp(n - 1, 0, rows - 1); break;
+	case 'H':
+	case 'f':
+		con->row = _Clamp((p0 ? p0 : 1) - 1, 0, rows - 1);
+		con->col = _Clamp((p1 ? p1 : 1) - 1, 0, cols - 1);
+		break;
+	case 'J':			// erase in display: 0 to the end, 1 from the start, 2 all
+		if (p0 == 0) {
+			ClearCells(con->row, con->col, cols - con->col);
+			for (int r = con->row + 1; r < rows; r++)
+				ClearCells(r, 0, cols);
+		} else if (p0 == 1) {
+			for (int r = 0; r < con->row; r++)
+				ClearCells(r, 0, cols);
+			ClearCells(con->row, 0, con->col + 1);
+		} else {
+			for (int r = 0; r < rows; r++)
+				ClearCells(r, 0, cols);
+		}
+		break;
+	case 'K':			// erase in line: 0 to the end, 1 from the start, 2 all
+		if (p0 == 0)
+			ClearCells(con->row, con->col, cols - con->col);
+		else if (p0 == 1)
+			ClearCells(con->row, 0, con->col + 1);
+		else
+			ClearCells(con->row, 0, cols);
+		break;
+	case 'L':			// insert and delete lines: only within the scroll region
+	case 'M':
+		if (con->row >= _RegionTop() && con->row <= _RegionBottom())
+			CharacterDisplayScrollRegion(con->row, _RegionBottom(), final == 'L' ? -n : n);
+		break;
+	case 'S': CharacterDisplayScrollRegion(_RegionTop(), _RegionBottom(), n); break;
+	case 'T': CharacterDisplayScrollRegion(_RegionTop(), _RegionBottom(), -n); break;
+	case 'm': _Sgr(); break;
+	case 'r': {			// DECSTBM: set the scroll region and home the cursor
+		int top = (p0 ? p0 : 1) - 1;
+		int bottom = (p1 ? p1 : rows) - 1;
+		if (bottom > rows - 1)
+			bottom = rows - 1;
+		if (top < bottom) {
+			con->top = top;
+			con->bottom = bottom;
+			con->region = (top != 0 || bottom != rows - 1);
+			con->row = con->col = 0;
+		}
+		break;
+	}
+	case 's': con->saved_row = con->row; con->saved_col = con->col; break;
+	case 'u':
+		con->row = _Clamp(con->saved_row, 0, rows - 1);
+		con->col = _Clamp(con->saved_col, 0, cols - 1);
+		break;
+	}
+}
+
+// feed one character of an escape sequence (cursor undrawn)
+static void _Escape(int c) {
+	if (con->esc == ESC_START) {
+		con->esc = ESC_NONE;
+		switch (c) {
+		case '[':
+			con->esc = ESC_CSI;
+			con->priv = 0;
+			con->nparams = 1;
+			con->params[0] = 0;
+			break;
+		case 27: con->esc = ESC_START; break;
+		case '7': con->saved_row = con->row; con->saved_col = con->col; break;
+		case '8':
+			con->row = _Clamp(con->saved_row, 0, D_CHAR_ROWS - 1);
+			con->col = _Clamp(con->saved_col, 0, D_CHAR_COLS - 1);
+			break;
+		case 'D': _LineFeed(); break;
+		case 'E': con->col = 0; _LineFeed(); break;
+		case 'M': _ReverseLineFeed(); break;
+		case 'c':			// reset
+			con->attr = con->attr_used = 0;
+			con->region = 0;
+			con->fg = D_COLOR_DEFAULT & 0x0f;
+			con->bg = D_COLOR_DEFAULT >> 4;
+			SetPenColor(D_COLOR_DEFAULT);
+			ClearTextDisplay();
+			con->row = con->col = 0;
+			break;
+		}
+		return;
+	}
+
+	// ESC_CSI: parameters, then a final character 0x40..0x7e
+	if (c >= '0' && c <= '9') {
+		unsigned v = con->params[con->nparams - 1] * 10 + (c - '0');
+		con->params[con->nparams - 1] = v > 9999 ? 9999 : v;
+	} else if (c == ';') {
+		if (con->nparams < CON_ESC_PARAMS)
+			con->params[con->nparams++] = 0;
+	} else if (c >= '<' && c <= '?') {
+		con->priv = c;
+	} else if (c >= 0x40 && c <= 0x7e) {
+		con->esc = ESC_NONE;
+		_Csi(c);
+	} else if (c == 27) {
+		con->esc = ESC_START;
+	} else if (c == 24 || c == 26) {	// CAN, SUB: abort
+		con->esc = ESC_NONE;
 	}
 }
 
@@ -191,13 +460,118 @@ void ConWriteCharacter(int c) {
  * CONSOLE STDIO EMULATION                                                   *
  * --------------------------------------------------------------------------*/
 
+// characters ConWriteCharacter() does not simply put on screen: BS TAB LF CR ESC
+#define CONTROL_MASK ((1u << 8) | (1u << 9) | (1u << 10) | (1u << 13) | (1u << 27))
+#define _IS_CONTROL(c) ((unsigned char)(c) < 32 && ((1u << (unsigned char)(c)) & CONTROL_MASK))
+
+// count the row advances writing n bytes from p would make, starting at column
+// col: stops in front of the character that would make advance number max + 1
+// and in front of an ESC.
+// Returns the number of advances, *len gets the byte count
+static int _CountAdvances(const char *p, int n, int col, int max, int *len) {
+	const char *start = p;
+	const char *end = p + n;
+	int advances = 0;
+	for (; p < end; p++) {
+		int c = (unsigned char)*p;
+		int adv = 0;
+		if (!_IS_CONTROL(c)) {
+			if (++col == D_CHAR_COLS) {
+				col = 0;
+				adv = 1;
+			}
+		} else if (c == 8) {
+			if (col > 0) col--;
+		} else if (c == 9) {
+			col = _NextTab(col);
+		} else if (c == 10) {
+			adv = 1;
+			if (IMPLICIT_CR) col = 0;
+		} else if (c == 13) {
+			col = 0;
+			adv = IMPLICIT_LF;
+		} else {
+			break;		// ESC: the sequence goes through _PutChar()
+		}
+		if (advances + adv > max)
+			break;
+		advances += adv;
+	}
+	*len = p - start;
+	return advances;
+}
+
+// write n bytes from p that are known not to need any scrolling (and hold no ESC)
+// printable runs go into the character screen with one copy per row
+static void _WriteSpan(const char *p, int n) {
+	const char *end = p + n;
+	while (p < end) {
+		int c = (unsigned char)*p;
+		if (c == 8) {
+			if (con->col > 0) con->col--;
+			PutCharacter(' ', con->row, con->col);
+		} else if (c == 10) {
+			con->row++;
+			if (IMPLICIT_CR) con->col = 0;
+		} else if (c == 13) {
+			con->col = 0;
+			if (IMPLICIT_LF) con->row++;
+		} else if (c == 9) {
+			con->col = _NextTab(con->col);
+		} else {
+			const char *q = p;
+			int room = D_CHAR_COLS - con->col;
+			while (q < end && q - p < room && !_IS_CONTROL(*q))
+				q++;
+			PutCharacters(p, q - p, con->row, con->col);
+			if (con->attr_used)
+				FillAttributes(con->attr & CON_ATTR_CELL, con->row, con->col, q - p);
+			con->col += q - p;
+			if (con->col == D_CHAR_COLS) {
+				con->col = 0;
+				con->row++;
+			}
+			p = q;
+			continue;
+		}
+		p++;
+	}
+}
+
+// write n bytes to the console, the cursor must have been undrawn by the caller
+// the output is written in segments of at most D_CHAR_ROWS - 1 row advances: the
+// scrolling a segment needs is done up front in one go, so the segment itself
+// is plain copying
+static void _ConWrite(const char *p, int n) {
+	if (con == shown)
+		UC_Write(p, n);		// mirrored to the uart bridge
+	while (n > 0) {
+		// escape sequences and scroll regions go character by character
+		if (con->esc || con->region || *p == 27) {
+			_PutChar((unsigned char)*p++);
+			n--;
+			continue;
+		}
+		int len;
+		int advances = _CountAdvances(p, n, con->col, D_CHAR_ROWS - 1, &len);
+		int scroll = con->row + advances - (D_CHAR_ROWS - 1);
+		if (scroll > 0) {
+			CharacterDisplayScrollUpLines(scroll);
+			con->row -= scroll;
+		}
+		_WriteSpan(p, len);
+		p += len;
+		n -= len;
+	}
+}
+
 // implements a minimal fputs() where stream is ignored (everything goes to the display)
+// the cursor gets undrawn and drawn once per call
 int Con_fputs(const char *p, FILE *stream) {
-	int count = 0;
-	while (*p) {
-		ConWriteCharacter(*p++);
-		count++;
-	}
+	int count = strlen(p);
+	UnDrawCursor();
+	_ConWrite(p, count);
+	DrawCursor();
 	return count;
 }
 
@@ -205,44 +579,61 @@ int Con_puts(const char* p) {
 	return Con_fputs(p, stdout);
 }
 
-#define BUFFER_SIZE 512
-static char buffer[BUFFER_SIZE];
+// formatted output streams straight from the formatter into the console writer
+static void _ConEmit(void *ctx, const char *s, int n) {
+	_ConWrite(s, n);
+}
+
+// emits at most *ctx bytes (Con_nprintf())
+static void _ConEmitLimited(void *ctx, const char *s, int n) {
+	size_t *room = ctx;
+	if ((size_t)n > *room)
+		n = *room;
+	*room -= n;
+	_ConWrite(s, n);
+}
 
-// checks if stream is not stdout or stderr: assume its a file and 
-// call into stdlib's vfprintf() in that case
-// returns error codes returned from C stdio
+static int _ConVprintf(const char *format, va_list argp) {
+	UnDrawCursor();
+	int err = CF_vformat(_ConEmit, NULL, format, argp);
+	DrawCursor();
+	return err;
+}
+
+// checks if stream is not stdout or stderr: assume its a file and
+// format into it with CF_vfprintf() in that case
+// returns the number of characters written
 int Con_fprintf(FILE *stream, const char* const format, ...) {
 	va_list argp;
 	int err = 0;
 
 	va_start(argp, format);
 	if (stream == stdout || stream == stderr) {
-		err = vsnprintf(buffer, BUFFER_SIZE, format, argp);
-		Con_fputs(buffer, 0);
+		err = _ConVprintf(format, argp);
 	} else {
-		err = vfprintf(stream, format, argp);
+		err = CF_vfprintf(stream, format, argp);
 	}
 	va_end(argp);
 	return err;
 }
 
-// length restricted printf
-// length passed in will additionaly be limited to BUFFER_SIZE
+// length restricted printf: like snprintf() at most len - 1 characters get written
 int Con_nprintf(size_t len, const char *format, ...) {
 	va_list argp;
+	size_t room = len ? len - 1 : 0;
 	va_start(argp, format);
-	int err = vsnprintf(buffer, (len <= BUFFER_SIZE) ? len : BUFFER_SIZE, format, argp);
+	UnDrawCursor();
+	int err = CF_vformat(_ConEmitLimited, &room, format, argp);
+	DrawCursor();
 	va_end(argp);
-	Con_fputs(buffer, 0);
 	return err;
 }
 
 int Con_printf(const char *format, ...) {
 	va_list argp;
 	va_start(argp, format);
-	int err = vsnprintf(buffer, BUFFER_SIZE, format, argp);
+	int err = _ConVprintf(format, argp);
 	va_end(argp);
-	Con_fputs(buffer, 0);
 	return err;
 }
 
@@ -252,11 +643,33 @@ int Con_putc(int c, FILE *Stream) {
 	return c;
 }
 
+// read from the console's input stream: the key press being followed gets its
+// latency recorded, one that was flushed unread is given up on
+static int _ReadInput() {
+	uint32_t pos = con->in.tail;
+	int c = StreamReadCharacter(&con->in);
+	if (__atomic_load_n(&con->probing, __ATOMIC_ACQUIRE) && (int32_t)(pos - con->probe_pos) >= 0) {
+		if (c && pos == con->probe_pos)
+			InputRecordLatency(con->probe_us);
+		__atomic_store_n(&con->probing, 0, __ATOMIC_RELEASE);
+	}
+	return c;
+}
+
 int Con_fputc(int c, FILE *Stream) {
 	ConWriteCharacter(c);
 	return c;
 };
 
+// input gets echoed when it is read: the keyboard interrupt path only stores it
+static void _Echo(int c) {
+	if (c && con->echo && !M16_META_CHAR(c) && c != 9 && c != 27) {	// don't echo meta characters, TAB (it completes) or ESC
+		if (con == &consoles[CON_SHELL])
+			SB_ViewLeave();		// echo goes to the live screen
+		ConWriteCharacter(c);
+	}
+}
+
 // Reads from our console stdin stream or passes through to C stdio (if stream is not stdin)
 // blocks if no data is available 
 int Con_getc(FILE* stream) {
@@ -266,11 +679,10 @@ int Con_getc(FILE* stream) {
 	if (stream == stdin) {
 		// wait for keyboard input to be available
 		do {
-			c = StreamReadCharacter(&CSTDIN);
+			InputPump();
+			c = _ReadInput();
 		} while (c == 0);
-	
-		//if (CON_ECHO && !M16_META_CHAR(c))	// don't echo meta characters
-			//ConWriteCharacter(c);
+		_Echo(c);
 	}
 	else {
 		c = getc(stream);		// pass through to C stdio if not stdin
@@ -281,11 +693,9 @@ int Con_getc(FILE* stream) {
 // non-blocking getc (stdin only)
 // returns 0 if no character is ready
 int Con_getc_nb() {
-	int c = StreamReadCharacter(&CSTDIN);
-	
-	//if (c && CON_ECHO && !M16_META_CHAR(c))	// don't echo meta characters
-	//	ConWriteCharacter(c);
-
+	InputPump();
+	int c = _ReadInput();
+	_Echo(c);
 	return c;
 }
 
@@ -293,15 +703,38 @@ int Con_getc_nb() {
 
 void Con_flush(FILE* stream) {
 	if (stream == stdin) {
-		StreamRewind(&CSTDIN);
+		StreamRewind(&con->in);
 	}
 }
 
+static void _InitConsole(struct Console *c) {
+	memset(c, 0, sizeof(*c));
+	c->echo = 1;
+	c->cursor_enabled = 1;
+	c->fg = D_COLOR_DEFAULT & 0x0f;
+	c->bg = D_COLOR_DEFAULT >> 4;
+	OpenCharacterStream(&c->in);
+}
+
+// the screen of console n, allocated on first use: a console nobody selects or
+// shows costs no heap. Returns -1 if it does not fit
+static int _OpenScreen(int n) {
+	if (con_open[n])
+		return 0;
+	if (DisplayOpenScreen(n) != 0)
+		return -1;
+	con_open[n] = 1;
+	return 0;
+}
+
 // This must be called before any other call to a public function in this file
+// all consoles take input right away, only the shell's has a screen yet
 void ConOpen() {
-	CROW = CCOL = 0;
+	for (int n = 0; n < CON_COUNT; n++)
+		_InitConsole(&consoles[n]);
+	_OpenScreen(CON_SHELL);
+	con = shown = keyboard = &consoles[CON_SHELL];
     DrawCursor();
-	OpenCharacterStream(&CSTDIN);
 }
 
 void ConClose() {
@@ -312,39 +745,111 @@ void ConClose() {
 }
 
 void ConReset() {
-	CROW = CCOL = 0;
+	con->row = con->col = 0;
 }
 
 void ConEchoOn() {
-	CON_ECHO = 1;
+	con->echo = 1;
 }
 
 void ConEchoOff() {
-	CON_ECHO = 0;
+	con->echo = 0;
+}
+
+/* --------------------------------------------------------------------------*
+ * VIRTUAL CONSOLES                                                          *
+ * --------------------------------------------------------------------------*/
+
+// direct output (and stdin reads) to console n
+// returns -1 if console n is not available (or its screen does not fit)
+int ConSelect(int n) {
+	if (n < 0 || n >= CON_COUNT || _OpenScreen(n) != 0)
+		return -1;
+	con = &consoles[n];
+	DisplaySelectScreen(n);
+	return 0;
+}
+
+// show console n and send keyboard input to it: a pointer swap, its screen
+// gets fully redrawn. Main loop only: the first time round it allocates the screen
+int ConShow(int n) {
+	if (n < 0 || n >= CON_COUNT || _OpenScreen(n) != 0)
+		return -1;
+	shown = keyboard = &consoles[n];
+	DisplayShowScreen(n);
+	UC_ClearScreen();
+	return 0;
+}
+
+// send keyboard input to console n ahead of ConShow(): keys typed after an
+// alt-F switch must not wait for the main loop to get there
+void ConInputTo(int n) {
+	if (n >= 0 && n < CON_COUNT)
+		keyboard = &consoles[n];
+}
+
+// select and show console n
+int ConSwitch(int n) {
+	if (ConSelect(n) != 0)
+		return -1;
+	return ConShow(n);
+}
+
+int ConGetCurrent() {
+	return con - consoles;
+}
+
+int ConGetVisible() {
+	return shown - consoles;
+}
+
+// keyboard input stream statistics of console n (0 if n is not available)
+void ConGetInputStats(int n, unsigned *high_water, unsigned *dropped) {
+	*high_water = *dropped = 0;
+	if (n >= 0 && n < CON_COUNT) {
+		*high_water = consoles[n].in.high_water;
+		*dropped = consoles[n].in.dropped;
+	}
 }
 
 /* --------------------------------------------------------------------------*
  * Keyboard Input Interface                                                  *
  * --------------------------------------------------------------------------*/
 
-// Feed external input from host app
-// this can be extended to process more complex input (see micro-conio.c)
-// but for now just characters will do
-void ConStoreCharacter(int c) {
+// Feed character input into the keyboard console: the translated key presses
+// and the uart bridge, both from the usb timer interrupt (the single producer
+// of the input streams). Nothing gets written to the screen here, the console
+// echoes what it reads
+static void _Store(struct Console *k, int c) {
 
-	if((c >= 32 && c < 127) || c == 13 || c == 8 || M16_META_CHAR(c)) {
+	if((c >= 32 && c < 127) || c == 13 || c == 8 || c == 9 || c == 27 || M16_META_CHAR(c)) {
 		if(c == 13) 	// HID will deliver 13 (CR) for the return key
 			c = 10;		// for our purposes we want 10 (LF) though
 
-		if(c==M16_CON_CURSOR_RIGHT)
-			printf("cursor right meta key\n");
-
-		StreamWriteCharacter(c, &CSTDIN);
+		StreamWriteCharacter(c, &k->in);
+	}
+}
 
-		//putchar(c);
-		if (CON_ECHO && !M16_META_CHAR(c))	// don't echo meta characters
-			ConWriteCharacter(c);
+void ConStoreCharacter(int c) {
+	_Store(keyboard, c);
+}
+
+// a key press whose report arrived at time_us: followed to where it gets read
+// unless another one is still on its way
+void ConStoreKey(int c, uint64_t time_us) {
+	struct Console *k = keyboard;
+	uint32_t pos = k->in.head;
+	_Store(k, c);
+	if (k->in.head != pos && !__atomic_load_n(&k->probing, __ATOMIC_ACQUIRE)) {
+		k->probe_us = time_us;
+		k->probe_pos = pos;
+		__atomic_store_n(&k->probing, 1, __ATOMIC_RELEASE);
 	}
 }
 
+// room left in the keyboard console's input stream
+int ConInputRoom() {
+	return CHARACTER_STREAM_BUFFER_SIZE - StreamPending(&keyboard->in);
+}
+
 // conio.c
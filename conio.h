@@ -1,6 +1,8 @@
 #pragma once
 #include <stdio.h>
 
+#include "display.h"
+
 // m16 console nonstandard codes (meta characters) for cursor keys and CTRL-key combos
 #define M16_CON_CURSOR_LEFT		4
 #define M16_CON_CURSOR_RIGHT	5
@@ -20,7 +22,8 @@
 #define M16_CON_END				25
 #define M16_CON_PGUP			26
 #define M16_CON_PGDOWN			28
-#define M16_META_CHAR(c) ((c >= 4 && c <= 7) || (c >= 14 && c <= 28))
+#define M16_CON_CTRL_R			29
+#define M16_META_CHAR(c) ((c >= 4 && c <= 7) || (c >= 14 && c <= 29))
 
 #ifdef CONIO_STDIO_OVERRIDES
 // latch in our stdlib replacements using simple defines
@@ -40,10 +43,15 @@
 #define getc Con_getc
 #endif
 
+// virtual consoles: each has its own screen, cursor and input stream
+#define CON_COUNT D_SCREEN_COUNT
+#define CON_SHELL	0
+#define CON_EDITOR	1
+
 void ConOpen();
 void ConClose();
 
-// stdio style output
+// stdio style output: BS TAB CR LF and a VT100/ANSI escape sequence subset (see conio.c)
 extern int Con_fputs(const char *p, FILE *stream);
 extern int Con_puts(const char* p);
 extern int Con_fprintf(FILE *stream, const char* const format, ...);
@@ -72,10 +80,25 @@ extern void ConCursorRight();
 extern void DrawCursor();
 extern void UnDrawCursor();
 
+// colours: palette indices (D_COLOR_xxx), used for all subsequent output
+void Con_SetColor(int fg, int bg);
+void Con_GetColor(int *fg, int *bg);
+
 extern void ConEchoOn();
 extern void ConEchoOff();
 
-// keyboard input interface
+// virtual consoles
+int ConSelect(int n);
+int ConShow(int n);
+int ConSwitch(int n);
+void ConInputTo(int n);
+int ConGetCurrent();
+int ConGetVisible();
+void ConGetInputStats(int n, unsigned *high_water, unsigned *dropped);
+
+// keyboard input interface (usb timer interrupt only)
 void ConStoreCharacter(int c);
+void ConStoreKey(int c, uint64_t time_us);	// a key press, time_us: when its report arrived
+int ConInputRoom();
 
 // conio.h
\ No newline at end of file
@@ -6,42 +6,52 @@
 
 #include "cstream.h"
 
+#define STREAM_MASK (CHARACTER_STREAM_BUFFER_SIZE - 1)
 
+// drop everything pending (consumer side)
 void StreamRewind(struct CharacterStream *stream) {
-	stream->write_pointer = stream->buffer;
-	stream->read_pointer = stream->buffer;
-	stream->size_remaining = CHARACTER_STREAM_BUFFER_SIZE;
+	uint32_t head = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&stream->tail, head, __ATOMIC_RELEASE);
 }
 
 void OpenCharacterStream(struct CharacterStream *stream) {
-	StreamRewind(stream);
+	stream->head = stream->tail = 0;
+	stream->high_water = 0;
+	stream->dropped = 0;
 }
 
-// write a single character to a character stream
-// will silently fail if the stream is full
+// write a single character to a character stream (producer side)
+// will fail if the stream is full: the character is counted as dropped
 void StreamWriteCharacter(int c, struct CharacterStream *stream) {
-	if (stream->size_remaining) {
-		*stream->write_pointer++ = c;
-		stream->size_remaining--;
-	} 
-#ifdef CONIO_DEBUG_PRINT
+	uint32_t head = stream->head;
+	uint32_t pending = head - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+	if (pending < CHARACTER_STREAM_BUFFER_SIZE) {
+		stream->buffer[head & STREAM_MASK] = c;
+		__atomic_store_n(&stream->head, head + 1, __ATOMIC_RELEASE);
+		if (pending + 1 > stream->high_water)
+			stream->high_water = pending + 1;
+	}
 	else {
+		stream->dropped++;
+#ifdef CONIO_DEBUG_PRINT
 		printf("Warning: stream overflow\n");
-	}
 #endif
+	}
 }
 
-// returns 0 if nothing to read
+// returns 0 if nothing to read (consumer side)
 int StreamReadCharacter(struct CharacterStream *stream) {
-	int c = 0;
-	if (stream->read_pointer < stream->write_pointer) {
-		c = *stream->read_pointer++;
-		// we've reached the write pointer (stream has been completely consumed): rewind
-		if (stream->read_pointer == stream->write_pointer) {
-			StreamRewind(stream);
-		}
-	}
+	uint32_t tail = stream->tail;
+	if (tail == __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE))
+		return 0;
+	int c = stream->buffer[tail & STREAM_MASK];
+	__atomic_store_n(&stream->tail, tail + 1, __ATOMIC_RELEASE);
 	return c;
 }
 
-// cstream.c
\ No newline at end of file
+// number of characters waiting to be read
+int StreamPending(struct CharacterStream *stream) {
+	return __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+}
+
+// cstream.c
@@ -1,19 +1,32 @@
 /* -------------------------------------------------------
  * CHARACTER STREAMS
+ * lock-free single producer / single consumer rings: the keyboard
+ * path writes, the main loop reads
  * ------------------------------------------------------*/
 
-#define CHARACTER_STREAM_BUFFER_SIZE 32
+#include <stdint.h>
+
+// must be a power of two
+#ifndef CHARACTER_STREAM_BUFFER_SIZE
+#define CHARACTER_STREAM_BUFFER_SIZE 256
+#endif
+
+#if CHARACTER_STREAM_BUFFER_SIZE & (CHARACTER_STREAM_BUFFER_SIZE - 1)
+#error CHARACTER_STREAM_BUFFER_SIZE must be a power of two
+#endif
 
 struct CharacterStream {
 	char buffer[CHARACTER_STREAM_BUFFER_SIZE];
-	char *write_pointer;
-	char *read_pointer;
-	int size_remaining;
+	uint32_t head;			// free running write index: only ever written by the producer
+	uint32_t tail;			// free running read index: only ever written by the consumer
+	uint32_t high_water;	// most characters pending at once
+	uint32_t dropped;		// characters lost because the stream was full
 };
 
 extern void OpenCharacterStream(struct CharacterStream *stream);
 extern void StreamRewind(struct CharacterStream *stream);
 extern void StreamWriteCharacter(int c, struct CharacterStream *stream);
 extern int StreamReadCharacter(struct CharacterStream *stream);
+int StreamPending(struct CharacterStream *stream);
 
 // cstream.h
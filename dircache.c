@@ -0,0 +1,314 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "ff.h"
+#include "dircache.h"
+
+static struct DirList dirs[DC_DIRS];
+static uint32_t use_clock = 0;
+static uint32_t total = 0;				// bytes held by all directories
+static uint32_t hits = 0, misses = 0;
+
+static DIR dir;
+static FILINFO fno;
+
+// f_getcwd() reads the card (it walks up the tree), so it is kept until the
+// current directory changes
+static char cwd[DC_PATH_MAX + 1];
+static bool cwd_known = false;
+
+// the cache key of a path: absolute, on the volume of the current directory
+// (there is one card, every drive prefix names it), without "." and ".."
+// components and without a trailing '/' (except for the root). So "", ".",
+// "/" and "0:/" all give the same key when the root is the current directory
+static int _Key(const char *path, char *key) {
+	if (!cwd_known) {
+		if (f_getcwd(cwd, sizeof(cwd)) != FR_OK)
+			return -1;
+		cwd_known = true;
+	}
+	const char *cwd_dir = strchr(cwd, ':');
+	cwd_dir = cwd_dir ? cwd_dir + 1 : cwd;		// the current directory without the drive
+	const char *colon = strchr(path, ':');
+	if (colon)
+		path = colon + 1;
+
+	size_t root = cwd_dir - cwd;				// the drive prefix, then the root '/'
+	size_t len = root;
+	memcpy(key, cwd, len);
+	key[len++] = '/';
+
+	// relative paths continue from the current directory
+	const char *parts[2] = { *path == '/' ? "" : cwd_dir, path };
+	for (int i = 0; i < 2; i++) {
+		const char *p = parts[i];
+		for (;;) {
+			while (*p == '/')
+				p++;
+			if (!*p)
+				break;
+			const char *end = p;
+			while (*end && *end != '/')
+				end++;
+			size_t n = end - p;
+			if (n == 2 && p[0] == '.' && p[1] == '.') {
+				while (len > root + 1 && key[len - 1] != '/')
+					len--;
+				if (len > root + 1)
+					len--;
+			}
+			else if (n != 1 || p[0] != '.') {
+				if (len > root + 1)
+					key[len++] = '/';
+				if (len + n > DC_PATH_MAX)
+					return -1;
+				memcpy(key + len, p, n);
+				len += n;
+			}
+			p = end;
+		}
+	}
+	key[len] = 0;
+	return 0;
+}
+
+// names on FAT are case insensitive
+static struct DirList *_Find(const char *key) {
+	for (int i = 0; i < DC_DIRS; i++)
+		if (dirs[i].last_use && !strcasecmp(dirs[i].path, key))
+			return &dirs[i];
+	return NULL;
+}
+
+static void _Drop(struct DirList *d) {
+	free(d->recs);
+	free(d->index);
+	total -= d->bytes;
+	memset(d, 0, sizeof(*d));
+}
+
+static struct DirList *_Oldest() {
+	struct DirList *oldest = &dirs[0];
+	for (int i = 1; i < DC_DIRS; i++)
+		if (dirs[i].last_use < oldest->last_use)
+			oldest = &dirs[i];
+	return oldest;
+}
+
+static const uint8_t *sort_recs;
+
+static int _CompareNames(const void *a, const void *b) {
+	return strcasecmp((const char *)sort_recs + *(const uint16_t *)a + 5,
+		(const char *)sort_recs + *(const uint16_t *)b + 5);
+}
+
+// read a directory into a slot (making room for it first)
+static FRESULT _Read(const char *key, const struct DirList **list) {
+	uint8_t *recs = NULL;
+	uint32_t used = 0, cap = 0;
+	int count = 0;
+
+	FRESULT res = f_opendir(&dir, key);
+	if (res != FR_OK)
+		return res;
+	for (;;) {
+		res = f_readdir(&dir, &fno);
+		if (res != FR_OK || fno.fname[0] == 0)
+			break;
+		uint32_t len = strlen(fno.fname);
+		uint32_t need = used + 6 + len;
+		if (need + (count + 1) * sizeof(uint16_t) > DC_BUDGET_BYTES) {
+			res = FR_NOT_ENOUGH_CORE;
+			break;
+		}
+		if (need > cap) {
+			cap = cap ? cap * 2 : 512;
+			while (cap < need)
+				cap *= 2;
+			uint8_t *p = realloc(recs, cap);
+			if (!p) {
+				res = FR_NOT_ENOUGH_CORE;
+				break;
+			}
+			recs = p;
+		}
+		uint8_t *r = recs + used;
+		uint32_t size = fno.fsize;
+		r[0] = fno.fattrib;
+		r[1] = size;
+		r[2] = size >> 8;
+		r[3] = size >> 16;
+		r[4] = size >> 24;
+		memcpy(r + 5, fno.fname, len + 1);
+		used = need;
+		count++;
+	}
+	f_closedir(&dir);
+
+	uint16_t *index = malloc(count ? count * sizeof(uint16_t) : 1);
+	if (res == FR_OK && !index)
+		res = FR_NOT_ENOUGH_CORE;
+	if (res != FR_OK) {
+		free(recs);
+		free(index);
+		return res;
+	}
+	if (used && used < cap) {
+		uint8_t *p = realloc(recs, used);
+		if (p)
+			recs = p;
+	}
+
+	for (int i = 0, offs = 0; i < count; i++) {
+		index[i] = offs;
+		offs += 6 + strlen((const char *)recs + offs + 5);
+	}
+	sort_recs = recs;
+	qsort(index, count, sizeof(uint16_t), _CompareNames);
+
+	uint32_t bytes = used + count * sizeof(uint16_t);
+	struct DirList *d = _Oldest();
+	if (d->last_use)
+		_Drop(d);
+	while (total + bytes > DC_BUDGET_BYTES) {
+		struct DirList *o = NULL;
+		for (int i = 0; i < DC_DIRS; i++)
+			if (dirs[i].last_use && (!o || dirs[i].last_use < o->last_use))
+				o = &dirs[i];
+		_Drop(o);
+	}
+
+	strcpy(d->path, key);
+	d->recs = recs;
+	d->index = index;
+	d->count = count;
+	d->bytes = bytes;
+	d->last_use = ++use_clock;
+	total += bytes;
+	*list = d;
+	return FR_OK;
+}
+
+FRESULT DC_Open(const char *path, const struct DirList **list) {
+	char key[DC_PATH_MAX + 1];
+
+	if (_Key(path, key) < 0)
+		return FR_NOT_ENOUGH_CORE;
+	struct DirList *d = _Find(key);
+	if (d) {
+		hits++;
+		d->last_use = ++use_clock;
+		*list = d;
+		return FR_OK;
+	}
+	misses++;
+	return _Read(key, list);
+}
+
+int DC_Complete(const char *text, char *out, int size, struct DirMatch *m) {
+	char path[DC_PATH_MAX + 1];
+	const char *slash = strrchr(text, '/');
+	const char *name = slash ? slash + 1 : text;
+	size_t plen = strlen(name);
+
+	m->list = NULL;
+	m->first = m->count = 0;
+	out[0] = 0;
+	if (slash) {
+		size_t dlen = slash > text ? slash - text : 1;		// "/x" completes in the root
+		if (dlen > DC_PATH_MAX)
+			return 0;
+		memcpy(path, text, dlen);
+		path[dlen] = 0;
+	}
+	else
+		path[0] = 0;
+
+	const struct DirList *d;
+	if (DC_Open(path, &d) != FR_OK)
+		return 0;
+
+	// the matches are one run of the sorted index
+	int lo = 0, hi = d->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (strncasecmp(DC_Name(d, mid), name, plen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	int n = 0;
+	while (lo + n < d->count && !strncasecmp(DC_Name(d, lo + n), name, plen))
+		n++;
+	m->list = d;
+	m->first = lo;
+	m->count = n;
+	if (!n)
+		return 0;
+
+	// what they all have in common beyond the typed part
+	const char *first = DC_Name(d, lo) + plen;
+	size_t common = strlen(first);
+	for (int i = 1; i < n && common; i++) {
+		const char *other = DC_Name(d, lo + i) + plen;
+		size_t j = 0;
+		while (j < common && other[j] && tolower((unsigned char)other[j]) == tolower((unsigned char)first[j]))
+			j++;
+		common = j;
+	}
+	int len = 0;
+	for (; len < (int)common && len < size - 1; len++)
+		out[len] = first[len];
+	if (n == 1 && DC_IsDir(d, lo) && len < size - 1)
+		out[len++] = '/';
+	out[len] = 0;
+	return len;
+}
+
+// a path that has no key could be any of the directories
+void DC_Invalidate(const char *path) {
+	char key[DC_PATH_MAX + 1];
+	struct DirList *d;
+
+	if (_Key(path, key) < 0)
+		DC_InvalidateAll();
+	else if ((d = _Find(key)))
+		_Drop(d);
+}
+
+void DC_InvalidateFile(const char *filename) {
+	char path[DC_PATH_MAX + 1];
+	const char *slash = strrchr(filename, '/');
+	size_t len = slash ? (slash > filename ? slash - filename : 1) : 0;
+
+	if (len > DC_PATH_MAX) {
+		DC_InvalidateAll();
+		return;
+	}
+	memcpy(path, filename, len);
+	path[len] = 0;
+	DC_Invalidate(path);
+}
+
+// the keys are absolute: only the current directory has to be asked for again
+void DC_InvalidateRelative() {
+	cwd_known = false;
+}
+
+void DC_InvalidateAll() {
+	for (int i = 0; i < DC_DIRS; i++)
+		if (dirs[i].last_use)
+			_Drop(&dirs[i]);
+	cwd_known = false;
+}
+
+void DC_GetStats(uint32_t *h, uint32_t *m, uint32_t *bytes) {
+	*h = hits;
+	*m = misses;
+	*bytes = total;
+}
+
+// dircache.c
@@ -0,0 +1,75 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * DIRECTORY CACHE
+ * the entries of recently used directories, keyed by their
+ * absolute path (every spelling of a directory finds the same
+ * one). Each directory is read once into compact records
+ * ([attr][size, 4 bytes][name] 0) with an index sorted by name
+ * (case insensitive, like FAT), so listings and path completion
+ * need no card access.
+ * All cached directories together stay within DC_BUDGET_BYTES,
+ * the least recently used ones are dropped to make room.
+ * Anything that writes to a directory must invalidate it
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ff.h"
+
+#ifndef DC_BUDGET_BYTES
+#define DC_BUDGET_BYTES 8192
+#endif
+
+#if DC_BUDGET_BYTES > 65535
+#error DC_BUDGET_BYTES: record offsets are 16 bit
+#endif
+
+#define DC_DIRS 4				// directories kept
+#define DC_PATH_MAX 63
+
+struct DirList {
+	char path[DC_PATH_MAX + 1];
+	uint8_t *recs;
+	uint16_t *index;			// record offsets sorted by name
+	uint16_t count;
+	uint16_t bytes;				// records plus index
+	uint32_t last_use;			// 0: slot is free
+};
+
+static inline const char *DC_Name(const struct DirList *d, int i) {
+	return (const char *)d->recs + d->index[i] + 5;
+}
+
+static inline bool DC_IsDir(const struct DirList *d, int i) {
+	return d->recs[d->index[i]] & AM_DIR;
+}
+
+static inline uint32_t DC_Size(const struct DirList *d, int i) {
+	const uint8_t *r = d->recs + d->index[i];
+	return r[1] | r[2] << 8 | r[3] << 16 | (uint32_t)r[4] << 24;
+}
+
+// the entries of path ("" is the current directory). FR_NOT_ENOUGH_CORE if the
+// directory does not fit the budget: it has to be read directly then
+FRESULT DC_Open(const char *path, const struct DirList **list);
+
+// the entries completing the last path component of text
+struct DirMatch {
+	const struct DirList *list;
+	int first, count;			// list entries starting with that component
+};
+
+// the characters all matches have in common beyond text go to out (a single
+// directory gets its '/' too). Returns their number
+int DC_Complete(const char *text, char *out, int size, struct DirMatch *m);
+
+void DC_Invalidate(const char *path);
+void DC_InvalidateFile(const char *filename);	// the directory the file is in
+void DC_InvalidateRelative();					// the current directory changed
+void DC_InvalidateAll();
+
+void DC_GetStats(uint32_t *hits, uint32_t *misses, uint32_t *bytes);
+
+// dircache.h
@@ -1,210 +1,641 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <malloc.h>
 #include <stdio.h>
 
+#include "pico/platform.h"	// for __not_in_flash_func()
+
 #include "display.h"
 #include "conio.h"
 #include "besciifont.h"
-
-extern uint8_t FRAMEBUF[];
-
+#include "scrollback.h"
+#include "latency.h"
 
 // this basically is our "character screen": 40x30 at 320x240 pixel resolution when using an 8x8 font
-static char charbuf[D_CHAR_ROWS * D_CHAR_COLS];
-static uint8_t attrbuf[D_CHAR_ROWS * D_CHAR_COLS];
+// or 80 columns at 640 pixels. Rows are always D_CHAR_COLS_MAX cells apart
+// every cell is a character code, an attribute byte and a colour byte (see D_COLORS())
+// there are up to D_SCREEN_COUNT of them: all writes go to the target screen, 
+// core1 renders the visible one
+struct Screen {
+	char charbuf[D_CHAR_ROWS_MAX * D_CHAR_COLS_MAX];
+	uint8_t attrbuf[D_CHAR_ROWS_MAX * D_CHAR_COLS_MAX];
+	uint8_t colbuf[D_CHAR_ROWS_MAX * D_CHAR_COLS_MAX];
+
+	// row indirection table: maps logical (on screen) rows to physical rows in the cell
+	// buffers, which turns scrolling into a rotation of this table
+	uint8_t rowmap[D_CHAR_ROWS_MAX];
+
+	// colour used for cells written by PutCharacter() and for clearing
+	uint8_t pen;
+};
+
+static struct Screen screen0 = { .pen = D_COLOR_DEFAULT };	// always there, the others get allocated by DisplayOpenScreen()
+static struct Screen *screens[D_SCREEN_COUNT] = { &screen0 };
+static struct Screen *target = &screen0;
+static struct Screen *volatile visible = &screen0;
+
+#define CHARROW(r) (target->charbuf + target->rowmap[r] * D_CHAR_COLS_MAX)
+#define ATTRROW(r) (target->attrbuf + target->rowmap[r] * D_CHAR_COLS_MAX)
+#define COLROW(r)  (target->colbuf + target->rowmap[r] * D_CHAR_COLS_MAX)
+
 static uint8_t masks[8] = { 128,64,32,16,8,4,2,1};
+
+// rgb332 values of the 16 colour indices
+static uint8_t palette[16] = {
+	0x00, 0x03, 0x10, 0x13, 0x80, 0x82, 0x88, 0xb6,		// black blue green cyan red magenta brown grey
+	0x49, 0x4f, 0x5d, 0x5f, 0xe9, 0xeb, 0xfc, 0xff		// and their bright counterparts
+};
+
 static unsigned long frame = 0;
 static uint8_t flash = 0;
 
+// one bit per character row: set whenever anything in the row changes,
+// cleared once the row has been rendered into the framebuffer
+static volatile uint32_t dirty_rows = 0;
+#define D_ALL_ROWS_DIRTY ((uint32_t)((1ull << D_CHAR_ROWS) - 1))
+
+// and a change count per row for core1 (see _ScanlineCells()): only core0 writes these
+static volatile uint32_t row_changes[D_CHAR_ROWS_MAX];
+
+static void _RowsChanged(uint32_t rows) {
+	dirty_rows |= rows;
+	for (int row = 0; rows; row++, rows >>= 1)
+		if (rows & 1)
+			row_changes[row]++;
+}
+
+// writes to a screen that is not visible never touch the renderer state
+static inline void _MarkRowDirty(int row) {
+	if (target == visible) {
+		dirty_rows |= 1u << row;
+		row_changes[row]++;
+	}
+}
+
+// characters written to the visible screen (see latency.h)
+static inline void _GlyphWritten(int row) {
+	if (target == visible)
+		LAT_Glyph(row);
+}
+
+static inline void _MarkAllDirty() {
+	if (target == visible)
+		_RowsChanged(D_ALL_ROWS_DIRTY);
+}
+
+// first and last are inclusive
+static inline void _MarkRowsDirty(int first, int last) {
+	if (target != visible) return;
+	if (first < 0) first = 0;
+	if (last >= D_CHAR_ROWS) last = D_CHAR_ROWS - 1;
+	if (first <= last)
+		_RowsChanged((D_ALL_ROWS_DIRTY >> (D_CHAR_ROWS - 1 - last + first)) << first);
+}
+
+// bit reversed glyph bytes for the 1bpp renderer: the 1bpp TMDS encoder takes the
+// leftmost pixel from bit 0
+static uint8_t glyph_rev[256];
+
+// palette expansion for the 2bpp and 4bpp graphics modes: one source byte to 
+// four (2bpp) or two (4bpp) rgb332 pixels, leftmost pixel in the lowest byte
+static uint32_t pal2_expand[256];
+static uint16_t pal4_expand[256];
+
+// glyph nibbles pre-expanded for every colour byte: 4 rgb332 pixels (fg for set
+// bits, bg for clear ones) per nibble, leftmost pixel in the lowest byte. With 16
+// palette entries there are only 256 fg/bg pairs, so this is 16K and a half cell
+// costs one lookup, the same as the monochrome table did
+static uint32_t color_expand[256][16];
+
+// the glyph byte expanded in the default colours: rows drawn all in those (the
+// usual case) take the monochrome path, one lookup per cell
+static uint32_t default_expand[256][2];
+
+// xor masks applied to the glyph byte before the table lookup (1bpp) or to swap fg
+// and bg (see _PrepareCells()), indexed by the inverse and flash attribute bits
+static uint8_t attr_xor[(D_ATTR_INVERSE | D_ATTR_FLASH) + 1];
+
+static void _BuildExpansionTable() {
+	for (int g = 0; g < 256; g++) {
+		uint8_t rev = 0;
+		for (int bit = 0; bit < 8; bit++)
+			if (g & masks[bit])
+				rev |= 1 << bit;
+		glyph_rev[g] = rev;
+	}
+}
+
+// needs to be called whenever the palette changes
+static void _BuildColorTables() {
+	for (int c = 0; c < 256; c++) {
+		uint8_t fg = palette[c & 0x0f];
+		uint8_t bg = palette[c >> 4];
+		for (int n = 0; n < 16; n++) {
+			uint32_t pixels = 0;
+			for (int bit = 0; bit < 4; bit++)
+				pixels |= (uint32_t)((n & (8 >> bit)) ? fg : bg) << (bit * 8);
+			color_expand[c][n] = pixels;
+		}
+
+		pal2_expand[c] = palette[c >> 6] | (palette[(c >> 4) & 3] << 8)
+			| (palette[(c >> 2) & 3] << 16) | ((uint32_t)palette[c & 3] << 24);
+		pal4_expand[c] = palette[c >> 4] | (palette[c & 0x0f] << 8);
+	}
+	for (int g = 0; g < 256; g++) {
+		default_expand[g][0] = color_expand[D_COLOR_DEFAULT][g >> 4];
+		default_expand[g][1] = color_expand[D_COLOR_DEFAULT][g & 0x0f];
+	}
+}
+
+// needs to be called whenever the flash state changes
+static void _UpdateAttrXor() {
+	attr_xor[0] = 0x00;
+	attr_xor[D_ATTR_INVERSE] = 0xff;
+	attr_xor[D_ATTR_FLASH] = flash ? 0xff : 0x00;
+	attr_xor[D_ATTR_INVERSE | D_ATTR_FLASH] = 0xff;		// inverse wins over flash
+}
+
 void ClearTextDisplay() {
-	memset(charbuf, 32, D_CHAR_ROWS*D_CHAR_COLS);
-	memset(attrbuf, 0, D_CHAR_ROWS*D_CHAR_COLS);
+	for (int row = 0; row < D_CHAR_ROWS_MAX; row++)
+		target->rowmap[row] = row;
+	memset(target->charbuf, 32, sizeof(target->charbuf));
+	memset(target->attrbuf, 0, sizeof(target->attrbuf));
+	memset(target->colbuf, target->pen, sizeof(target->colbuf));
+	_MarkAllDirty();
+}
+
+// force a full redraw with the next RenderTextDisplay(), for instance because
+// something else has been drawing into the framebuffer in the meantime
+void DisplayInvalidate() {
+	_RowsChanged(D_ALL_ROWS_DIRTY);
+}
+
+// adopt the character screen geometry of display mode
+// all screens get cleared if it actually changes
+void DisplaySetGeometry(int mode) {
+	const struct DisplayMode *m = &DISPLAY_MODES[mode];
+	int changed = (m->cols != D_MODE->cols || m->rows != D_MODE->rows);
+	D_MODE = m;
+	if (changed) {
+		struct Screen *t = target;
+		for (int n = 0; n < D_SCREEN_COUNT; n++) {
+			if (screens[n]) {
+				target = screens[n];
+				ClearTextDisplay();
+			}
+		}
+		target = t;
+		DisplayInvalidate();
+	}
+}
+
+// allocate character screen n (if it does not exist yet)
+// returns 0 on success or -1 if n is invalid or there is not enough memory
+int DisplayOpenScreen(int n) {
+	if (n < 0 || n >= D_SCREEN_COUNT)
+		return -1;
+	if (screens[n])
+		return 0;
+	struct Screen *scr = malloc(sizeof(struct Screen));
+	if (!scr)
+		return -1;
+	struct Screen *t = target;
+	target = scr;
+	target->pen = D_COLOR_DEFAULT;
+	ClearTextDisplay();
+	target = t;
+	screens[n] = scr;
+	return 0;
+}
+
+// direct all subsequent writes to screen n (which must have been opened)
+void DisplaySelectScreen(int n) {
+	if (n >= 0 && n < D_SCREEN_COUNT && screens[n])
+		target = screens[n];
+}
+
+// make screen n the one that gets rendered: just a pointer swap and a full redraw
+void DisplayShowScreen(int n) {
+	if (n >= 0 && n < D_SCREEN_COUNT && screens[n]) {
+		visible = screens[n];
+		DisplayInvalidate();
+	}
 }
 
 void DisplayOpen() {
+	_BuildExpansionTable();
+	_BuildColorTables();
+	_UpdateAttrXor();
 	ClearTextDisplay();
 }
 
 // Put a character into our character display buffer at row,col
+// the cell takes on the current pen colour
 // NOTE: this does no boundaries checking whatsoever
 void PutCharacter(int c, int row, int col) {
-		char *CPTR = charbuf + D_CHAR_COLS * row + col;
+		char *CPTR = CHARROW(row) + col;
 		*CPTR = (uint8_t)c;
+		COLROW(row)[col] = target->pen;
+		_MarkRowDirty(row);
+		_GlyphWritten(row);
+}
+
+// Put n characters into row starting at col (in the current pen colour)
+// NOTE: no boundaries checking either: the run must fit into the row
+void PutCharacters(const char *chars, int n, int row, int col) {
+	memcpy(CHARROW(row) + col, chars, n);
+	memset(COLROW(row) + col, target->pen, n);
+	_MarkRowDirty(row);
+	_GlyphWritten(row);
+}
+
+// write a whole row: n cells from chars (plus attrs and colors if not NULL, 
+// otherwise no attributes and the pen colour), the rest of the row is cleared
+void DisplayWriteRow(int row, const char *chars, const uint8_t *attrs, const uint8_t *colors, int n) {
+	memcpy(CHARROW(row), chars, n);
+	memset(CHARROW(row) + n, 32, D_CHAR_COLS - n);
+	if (attrs)
+		memcpy(ATTRROW(row), attrs, n);
+	else
+		memset(ATTRROW(row), 0, n);
+	memset(ATTRROW(row) + n, 0, D_CHAR_COLS - n);
+	if (colors)
+		memcpy(COLROW(row), colors, n);
+	else
+		memset(COLROW(row), target->pen, n);
+	memset(COLROW(row) + n, target->pen, D_CHAR_COLS - n);
+	_MarkRowDirty(row);
+	_GlyphWritten(row);
+}
+
+// the size of a screen snapshot: characters, then attributes, then colours of
+// all rows in on screen order
+size_t DisplayScreenBytes() {
+	return 3 * D_CHAR_ROWS * D_CHAR_COLS;
+}
+
+void DisplaySaveScreen(uint8_t *buf) {
+	int cells = D_CHAR_ROWS * D_CHAR_COLS;
+	for (int row = 0; row < D_CHAR_ROWS; row++) {
+		memcpy(buf + row * D_CHAR_COLS, CHARROW(row), D_CHAR_COLS);
+		memcpy(buf + cells + row * D_CHAR_COLS, ATTRROW(row), D_CHAR_COLS);
+		memcpy(buf + 2 * cells + row * D_CHAR_COLS, COLROW(row), D_CHAR_COLS);
+	}
+}
+
+void DisplayRestoreScreen(const uint8_t *buf) {
+	int cells = D_CHAR_ROWS * D_CHAR_COLS;
+	for (int row = 0; row < D_CHAR_ROWS; row++) {
+		memcpy(CHARROW(row), buf + row * D_CHAR_COLS, D_CHAR_COLS);
+		memcpy(ATTRROW(row), buf + cells + row * D_CHAR_COLS, D_CHAR_COLS);
+		memcpy(COLROW(row), buf + 2 * cells + row * D_CHAR_COLS, D_CHAR_COLS);
+	}
+	_MarkAllDirty();
+}
+
+// set the colour byte (see D_COLORS()) of the cell at row,col
+void SetColor(uint8_t color, int row, int col) {
+		COLROW(row)[col] = color;
+		_MarkRowDirty(row);
+}
+
+// set the colour used by PutCharacter() and for clearing
+void SetPenColor(uint8_t color) {
+	target->pen = color;
+}
+
+uint8_t GetPenColor() {
+	return target->pen;
+}
+
+// change the rgb332 value of one of the 16 colour indices
+void SetPaletteColor(int index, uint8_t rgb332) {
+	palette[index & 0x0f] = rgb332;
+	_BuildColorTables();
+	dirty_rows = D_ALL_ROWS_DIRTY;		// core1 picks the new colours up by itself
+}
+
+// set the attribute byte of n cells to exactly a (the run must fit into the row)
+void FillAttributes(uint8_t a, int row, int col, int n) {
+	memset(ATTRROW(row) + col, a, n);
+	_MarkRowDirty(row);
+}
+
+// blank n cells starting at row,col: spaces, no attributes, the pen colour
+void ClearCells(int row, int col, int n) {
+	memset(CHARROW(row) + col, 32, n);
+	memset(ATTRROW(row) + col, 0, n);
+	memset(COLROW(row) + col, target->pen, n);
+	_MarkRowDirty(row);
 }
 
 void SetAttribute(uint8_t a, int row, int col) {
-		uint8_t *APTR = attrbuf + D_CHAR_COLS * row + col;
+		uint8_t *APTR = ATTRROW(row) + col;
 		*APTR |= a;
+		_MarkRowDirty(row);
 }
 
 void UnSetAttribute(uint8_t a, int row, int col) {
-		uint8_t *APTR = attrbuf + D_CHAR_COLS * row + col;
+		uint8_t *APTR = ATTRROW(row) + col;
 		*APTR &= ~a;
+		_MarkRowDirty(row);
 }
 
-// called from core1 scanline callback: pretty timing critical
-void inline RenderTextScanline(int y) {
+// the scanline renderer's view of a character row: the characters and the colours
+// they are drawn in (fg and bg swapped for inverse and, while the flash state is on,
+// flashing cells). A row all in the default colours keeps the glyph xor masks instead
+struct RowCells {
+	uint8_t chars[D_FRAME_WIDTH / 8];
+	uint8_t colors[D_FRAME_WIDTH / 8];
+	uint8_t plain;					// colors holds attr_xor masks
+};
+
+static void __not_in_flash_func(_PrepareCells)(struct RowCells *cells, int char_row) {
+    const struct Screen *scr = visible;
+    int index = scr->rowmap[char_row] * D_CHAR_COLS_MAX;
+    const uint8_t *attrs = scr->attrbuf + index;
+    const uint8_t *colors = scr->colbuf + index;
+
+    memcpy(cells->chars, scr->charbuf + index, D_FRAME_WIDTH / 8);
+    uint8_t other = 0;
+    for(int i = 0; i < D_FRAME_WIDTH / 8; i++)
+        other |= colors[i] ^ D_COLOR_DEFAULT;
+    cells->plain = !other;
+    for(int i = 0; i < D_FRAME_WIDTH / 8; i++) {
+        uint8_t color = colors[i];
+        uint8_t swap = attr_xor[attrs[i] & (D_ATTR_INVERSE | D_ATTR_FLASH)];
+        cells->colors[i] = other ? (color & ~swap) | (((color >> 4) | (color << 4)) & swap) : swap;
+    }
+}
 
+// every cell is one glyph byte and two lookups in the expansion table of its colours
+// (or one in the default colours' table)
+static inline void _RenderCells(uint32_t *dst, const struct RowCells *cells, int offset) {
+    const uint8_t *font = bescii + offset - D_FONT_FIRST_ASCII * D_FONT_HEIGHT;
+    const uint8_t *chars = cells->chars;
+    const uint8_t *colors = cells->colors;
+    uint32_t *end = dst + D_FRAME_WIDTH / 4;
+
+    if (cells->plain) {
+        while (dst < end) {
+            const uint32_t *pixels = default_expand[font[*chars++ * D_FONT_HEIGHT] ^ *colors++];
+            dst[0] = pixels[0];
+            dst[1] = pixels[1];
+            dst += 2;
+        }
+        return;
+    }
+    while (dst < end) {
+        const uint32_t *pixels = color_expand[*colors++];
+        uint32_t g = font[*chars++ * D_FONT_HEIGHT];
+        dst[0] = pixels[g >> 4];
+        dst[1] = pixels[g & 0x0f];
+        dst += 2;
+    }
+}
+
+// core1 keeps the prepared rows of the visible screen and only prepares a row again
+// once its change count has moved on: while the text stays put a scanline costs no
+// more than in monochrome
+static struct RowCells core1_cells[D_CHAR_ROWS_MAX];
+static uint32_t core1_changes[D_CHAR_ROWS_MAX];
+
+static const struct RowCells *__not_in_flash_func(_ScanlineCells)(int char_row) {
+    uint32_t changes = row_changes[char_row];
+    if (changes != core1_changes[char_row]) {
+        core1_changes[char_row] = changes;		// read first: a change while preparing comes round again
+        _PrepareCells(&core1_cells[char_row], char_row);
+    }
+    return &core1_cells[char_row];
+}
+
+// render one scanline of the character screen into dst (D_FRAME_WIDTH rgb332 pixels)
+// called from the core1 scanline callback in text mode: pretty timing critical
+void __not_in_flash_func(RenderTextScanlineBuf)(uint32_t *dst, int y) {
+	_RenderCells(dst, _ScanlineCells(y / D_FONT_HEIGHT), y % D_FONT_HEIGHT);
+}
+
+// render one scanline of the character screen into dst as 1bpp pixels, one byte 
+// per cell: used by the 80 column mode (monochrome, the colour bytes are ignored)
+void __not_in_flash_func(RenderTextScanline1bpp)(uint8_t *dst, int y) {
 
     int char_row = y / D_FONT_HEIGHT;
     int offset = y % D_FONT_HEIGHT;
-    int index = char_row * D_CHAR_COLS;
+    const struct Screen *scr = visible;
+    int index = scr->rowmap[char_row] * D_CHAR_COLS_MAX;
 
-    int fb_offset = y * D_FRAME_WIDTH;
+    const uint8_t *font = bescii + offset - D_FONT_FIRST_ASCII * D_FONT_HEIGHT;
 
     for(int i = 0; i < D_CHAR_COLS; i++) {
-        char c = charbuf[index+i] - D_FONT_FIRST_ASCII;
-		uint8_t a = attrbuf[index+i];
-        uint8_t src_pixels = bescii[c * D_FONT_HEIGHT + offset];
-        
-		if((a & D_ATTR_INVERSE) || ((a & D_ATTR_FLASH) && flash)) {
-			// inverse video
-			src_pixels = src_pixels ^ 0xff;	// invert by xor
-        }
+        uint8_t c = scr->charbuf[index+i];
+        uint8_t a = scr->attrbuf[index+i] & (D_ATTR_INVERSE | D_ATTR_FLASH);
+        *dst++ = glyph_rev[font[c * D_FONT_HEIGHT] ^ attr_xor[a]];
+    }
+}
+
+// expand n bytes of 2bpp pixels into 4*n rgb332 pixels
+void __not_in_flash_func(ExpandPixels2bpp)(uint32_t *dst, const uint8_t *src, int n) {
+	for (int i = 0; i < n; i++)
+		*dst++ = pal2_expand[src[i]];
+}
+
+// expand n bytes of 4bpp pixels into 2*n rgb332 pixels (n must be even)
+void __not_in_flash_func(ExpandPixels4bpp)(uint32_t *dst, const uint8_t *src, int n) {
+	for (int i = 0; i < n; i += 2)
+		*dst++ = pal4_expand[src[i]] | (pal4_expand[src[i + 1]] << 16);
+}
+
+// render one scanline of the character screen into the framebuffer
+void RenderTextScanline(int y) {
+	struct RowCells cells;
+	_PrepareCells(&cells, y / D_FONT_HEIGHT);
+	_RenderCells((uint32_t *) &FRAMEBUF[y * D_FRAME_WIDTH], &cells, y % D_FONT_HEIGHT);
+}
 
-        // scan the 8 glyph bits
-    	for (int bit = 0; bit < 8; bit++) {
-			// scan the bits inside the glyph byte and write pixels accordingly
-            FRAMEBUF[fb_offset] = 0x03;
-			if (src_pixels & masks[bit]) {
-                   FRAMEBUF[fb_offset] = 0xff;
-			} 
-            fb_offset++;
+// returns a row bitmap of all rows holding at least one flashing cell
+// (on the visible screen)
+static uint32_t _FlashingRows() {
+	const struct Screen *scr = visible;
+	uint32_t rows = 0;
+	for (int row = 0; row < D_CHAR_ROWS; row++) {
+		const uint8_t *ap = scr->attrbuf + scr->rowmap[row] * D_CHAR_COLS_MAX;
+		for (int col = 0; col < D_CHAR_COLS; col++) {
+			if (ap[col] & D_ATTR_FLASH) {
+				rows |= 1u << row;
+				break;
+			}
 		}
-    }
+	}
+	return rows;
+}
+
+// render all character rows that changed since the last call (plus the ones
+// holding flashing cells whenever the flash state toggles) into the framebuffer
+// drive this at 50hz or so for a sensible cursor blink rate
+// in the text modes (and graphics modes other than 8bpp) this just drives the flash state
+void RenderTextDisplay() {
+
+	// drive frame count and flash attribute
+	frame++;
+	if(!(frame%D_FLASH_DELAY)) {
+		flash = !flash;
+		_UpdateAttrXor();
+		_RowsChanged(_FlashingRows());
+	}
 
-    // drive this at 50hz or so for a sensible cursor blink rate
-    // drive frame count and flash attribute
-   	if(!(y%D_FRAME_HEIGHT)) { 
-		frame++;
-		if(!(frame%D_FLASH_DELAY))
-			flash = !flash;
+	if (!FRAMEBUF || D_MODE->bpp != 8) {
+		dirty_rows = 0;		// core1 renders straight from the buffers (or there is no overlay)
+		return;
 	}
 
+	uint32_t rows = dirty_rows;
+	dirty_rows = 0;
+
+	for (int row = 0; rows; row++, rows >>= 1) {
+		if (rows & 1) {
+			int y = row * D_FONT_HEIGHT;
+			for (int line = 0; line < D_FONT_HEIGHT; line++)
+				RenderTextScanline(y + line);
+		}
+	}
 }
 
 // ----------------------------------------------------------------------------
 // SCROLLING
 // ----------------------------------------------------------------------------
 
-// Scrolls both, the characters and the attributes buffers
-void CharacterDisplayScrollUp() {
-	char *dp;
-	char *sp = NULL;
-	
-	uint8_t *asp = NULL;
+// rotate logical rows first..last (inclusive) up by one: first wraps around to last
+static void _RotateRowsUp(int first, int last) {
+	uint8_t top = target->rowmap[first];
+	memmove(&target->rowmap[first], &target->rowmap[first + 1], last - first);
+	target->rowmap[last] = top;
+}
 
-	UnDrawCursor();
+// rotate logical rows first..last (inclusive) down by one: last wraps around to first
+static void _RotateRowsDown(int first, int last) {
+	uint8_t bottom = target->rowmap[last];
+	memmove(&target->rowmap[first + 1], &target->rowmap[first], last - first);
+	target->rowmap[first] = bottom;
+}
 
-	// Note that this implementation relies on the width specifications matching 
-	// the buffer width in bytes (i.e one character code stored being one byte too)
-	for (int row = 1; row < D_CHAR_ROWS; row++) {
-		dp = &charbuf[(row - 1) * D_CHAR_COLS];
-		sp = &charbuf[row * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-
-		// scroll attributes too
-		uint8_t *adp = &attrbuf[(row - 1) * D_CHAR_COLS];
-		asp = &attrbuf[row * D_CHAR_COLS];
-		memcpy(adp, asp, D_CHAR_COLS);
-	}
-	// clear bottom line
-	memset(sp, 32, D_CHAR_COLS);
-	memset(asp, 0, D_CHAR_COLS);
+static void _ClearRow(int row) {
+	memset(CHARROW(row), 32, D_CHAR_COLS);
+	memset(ATTRROW(row), 0, D_CHAR_COLS);
+	memset(COLROW(row), target->pen, D_CHAR_COLS);
+}
+
+static void _CopyRow(int dst, int src) {
+	memcpy(CHARROW(dst), CHARROW(src), D_CHAR_COLS);
+	memcpy(ATTRROW(dst), ATTRROW(src), D_CHAR_COLS);
+	memcpy(COLROW(dst), COLROW(src), D_CHAR_COLS);
+}
 
+// Scrolls the whole screen up by one row and clears the bottom row
+void CharacterDisplayScrollUp() {
+	UnDrawCursor();
+	if (target == &screen0)
+		SB_Append(CHARROW(0), D_CHAR_COLS);	// the top row goes into the scrollback (shell screen only)
+	_RotateRowsUp(0, D_CHAR_ROWS - 1);
+	_ClearRow(D_CHAR_ROWS - 1);
+	_MarkAllDirty();
 	DrawCursor();
+}
 
+// Scrolls the whole screen up by n rows in one go and clears the bottom n rows
+// unlike CharacterDisplayScrollUp() this leaves the cursor alone: for callers
+// that already have it undrawn (see Con_fputs())
+void CharacterDisplayScrollUpLines(int n) {
+	if (n <= 0)
+		return;
+	if (n > D_CHAR_ROWS)
+		n = D_CHAR_ROWS;
+	if (target == &screen0)
+		for (int row = 0; row < n; row++)
+			SB_Append(CHARROW(row), D_CHAR_COLS);
+
+	uint8_t top[D_CHAR_ROWS_MAX];
+	memcpy(top, target->rowmap, n);
+	memmove(target->rowmap, target->rowmap + n, D_CHAR_ROWS - n);
+	memcpy(target->rowmap + D_CHAR_ROWS - n, top, n);
+	for (int row = D_CHAR_ROWS - n; row < D_CHAR_ROWS; row++)
+		_ClearRow(row);
+	_MarkAllDirty();
 }
 
 // scroll everything above r (exclusive) upwards
+// row r-1 keeps its content (it ends up duplicated in row r-2)
 void CharacterDisplayScrollUpRow(int r) {
-	uint8_t *dp;
-	uint8_t *sp = NULL;
-
 	UnDrawCursor();
-
-	for (int row = 1; row < r; row++) {
-		dp = (uint8_t*) &charbuf[(row - 1) * D_CHAR_COLS];
-		sp = (uint8_t*) &charbuf[row * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-
-		dp = &attrbuf[(row - 1) * D_CHAR_COLS];
-		sp = &attrbuf[row * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
+	if (r > 1) {
+		_RotateRowsUp(0, r - 1);
+		_CopyRow(r - 1, r - 2);
 	}
-	// clear bottom line
-	//memset(sp, 0, DISPLAY_DATA.display_mode.width);
+	_MarkRowsDirty(0, r - 1);
 	DrawCursor();
 }
 
 // scroll down, starting at top of display down to row r (inclusive)
+// row 0 keeps its content (it ends up duplicated in row 1)
 void CharacterDisplayScrollDownRow(int r) {
-	char *dp;
-	char *sp = NULL;
-
 	UnDrawCursor();
-
-	// Note that this algorithm relies on the width specifications matching 
-	// the buffer width in bytes (i.e one character code stored being one byte too)
-	for (int row = r; row > 0; row--) {
-		dp = &charbuf[row * D_CHAR_COLS];
-		sp = &charbuf[(row - 1) * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-
-		dp = (char*) &attrbuf[row * D_CHAR_COLS];
-		sp = (char*) &attrbuf[(row - 1) * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
+	if (r > 0) {
+		_RotateRowsDown(0, r);
+		_CopyRow(0, 1);
 	}
-
+	_MarkRowsDirty(0, r);
 	DrawCursor();
-
 }
 
-
-// start and end rows are inclusive
+// start and end rows are inclusive: rows start_r-1..end_r-1 move down by one
+// row start_r-1 keeps its content (it ends up duplicated in row start_r)
 void CharacterDisplayScrollDownRange(int start_r, int end_r) {
 
-	if (end_r == start_r)
+	if (end_r <= start_r || start_r < 1)
 		return;				// nothing to do
 
-	uint8_t *dp;
-	uint8_t *sp = NULL;
-
 	UnDrawCursor();
-
-	for (int row = end_r; row >= start_r; row--) {
-		dp = (uint8_t*) & charbuf[row * D_CHAR_COLS];
-		sp = (uint8_t *)&charbuf[(row - 1) * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-
-		dp = (uint8_t *)&attrbuf[row * D_CHAR_COLS];
-		sp = (uint8_t *)&attrbuf[(row - 1) * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-	}
-
+	_RotateRowsDown(start_r - 1, end_r);
+	_CopyRow(start_r - 1, start_r);
+	_MarkRowsDirty(start_r - 1, end_r);
 	DrawCursor();
 }
 
-// start and end rows are inclusive
+// start and end rows are inclusive: rows start_r..end_r move up by one
+// row end_r keeps its content (it ends up duplicated in row end_r-1)
 void CharacterDisplayScrollUpRange(int start_r, int end_r) {
-	char *dp;
-	char *sp = NULL;
 
-	UnDrawCursor();
-
-	for (int row = start_r; row <= end_r; row++) {
-		dp = &charbuf[(row - 1) * D_CHAR_COLS];
-		sp = &charbuf[row * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-
-		dp = (char*) &attrbuf[(row - 1) * D_CHAR_COLS];
-		sp = (char*) &attrbuf[row * D_CHAR_COLS];
-		memcpy(dp, sp, D_CHAR_COLS);
-	}
+	if (end_r < start_r || start_r < 1)
+		return;				// nothing to do
 
+	UnDrawCursor();
+	_RotateRowsUp(start_r - 1, end_r);
+	_CopyRow(end_r, end_r - 1);
+	_MarkRowsDirty(start_r - 1, end_r);
 	DrawCursor();
 }
 
+// scroll rows top..bottom (inclusive) up by n rows (down for negative n), the rows
+// that get uncovered are cleared. Leaves the cursor and the scrollback alone
+void CharacterDisplayScrollRegion(int top, int bottom, int n) {
+	int height = bottom - top + 1;
+	if (height <= 0 || n == 0)
+		return;
+	if (n >= height || n <= -height) {
+		for (int row = top; row <= bottom; row++)
+			_ClearRow(row);
+	} else if (n > 0) {
+		for (int i = 0; i < n; i++)
+			_RotateRowsUp(top, bottom);
+		for (int row = bottom - n + 1; row <= bottom; row++)
+			_ClearRow(row);
+	} else {
+		for (int i = 0; i < -n; i++)
+			_RotateRowsDown(top, bottom);
+		for (int row = top; row < top - n; row++)
+			_ClearRow(row);
+	}
+	_MarkRowsDirty(top, bottom);
+}
 
-// display.c
\ No newline at end of file
+// display.c
@@ -1,11 +1,28 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define D_FRAME_WIDTH 320
 #define D_FRAME_HEIGHT 240
 
-#define D_CHAR_COLS 40
-#define D_CHAR_ROWS 30
+// character screen buffers are sized for the largest text mode
+#define D_CHAR_COLS_MAX 80
+#define D_CHAR_ROWS_MAX 30
+
+// 80 column rows: 30 at the default DVI_VERTICAL_REPEAT of 2, 80x60 would need 
+// libdvi built with DVI_VERTICAL_REPEAT=1 (and a 64 bit dirty row bitmap)
+#define D_TEXT80_ROWS 30
+
+// number of independent character screens (see DisplayOpenScreen())
+#ifndef D_SCREEN_COUNT
+#define D_SCREEN_COUNT 4
+#endif
+
+// text geometry of the current display mode
+#define D_CHAR_COLS (D_MODE->cols)
+#define D_CHAR_ROWS (D_MODE->rows)
 
 #define D_FONT_HEIGHT 8
 #define D_FONT_FIRST_ASCII 32
@@ -13,21 +30,94 @@
 #define D_ATTR_INVERSE    0b00000001
 #define D_ATTR_FLASH      0b00000010
 
+// text colours: indices into a 16 entry rgb332 palette
+#define D_COLOR_BLACK         0
+#define D_COLOR_BLUE          1
+#define D_COLOR_GREEN         2
+#define D_COLOR_CYAN          3
+#define D_COLOR_RED           4
+#define D_COLOR_MAGENTA       5
+#define D_COLOR_BROWN         6
+#define D_COLOR_GREY          7
+#define D_COLOR_DARK_GREY     8
+#define D_COLOR_LIGHT_BLUE    9
+#define D_COLOR_LIGHT_GREEN   10
+#define D_COLOR_LIGHT_CYAN    11
+#define D_COLOR_LIGHT_RED     12
+#define D_COLOR_LIGHT_MAGENTA 13
+#define D_COLOR_YELLOW        14
+#define D_COLOR_WHITE         15
+
+// a cell's colour byte: foreground index in the low, background index in the high nibble
+#define D_COLORS(fg, bg)  (((fg) & 0x0f) | (((bg) & 0x0f) << 4))
+#define D_COLOR_DEFAULT   D_COLORS(D_COLOR_WHITE, D_COLOR_BLUE)
+
+// display modes (see display_modes.c)
+#define D_MODE_TEXT        0	// 40x30 rendered per scanline from the character screen, no framebuffer
+#define D_MODE_FRAMEBUFFER 1	// 320x240 8bpp rgb332 framebuffer, 40x30 console overlay
+#define D_MODE_TEXT80      2	// 80 columns, 1bpp at the full 640 pixel resolution
+#define D_MODE_BITMAP      3	// 640x240 1bpp bitmap, bit 0 is the leftmost pixel of a byte
+#define D_MODE_PAL2        4	// 320x240 2bpp, palette entries 0..3, leftmost pixel in the top bits
+#define D_MODE_PAL4        5	// 320x240 4bpp, palette entries 0..15, leftmost pixel in the high nibble
+#define D_MODE_COUNT       6
+
+struct DisplayMode {
+	const char *name;
+	int width, height;		// pixels
+	int cols, rows;			// character screen geometry
+	int bpp;				// bits per framebuffer pixel, 0 for the text modes
+	uint32_t fb_size;		// framebuffer memory budget in bytes (allocated on entry)
+	void (*scanline)(int y, uint32_t *tmdsbuf);	// core1: produce TMDS symbols for line y
+	void (*enter)(void);	// optional: called on core0 after switching to the mode
+};
+
+extern const struct DisplayMode DISPLAY_MODES[D_MODE_COUNT];
+extern const struct DisplayMode *D_MODE;	// current mode
+
+// pixel memory of the current graphics mode, NULL in the text modes
+extern uint8_t *FRAMEBUF;
+
 #define D_FLASH_DELAY 20      // delay in frames (30 = 1/2 sec at 60fps)
 
 void DisplayOpen();
+int DisplaySetMode(int mode);
+int DisplayGetMode();
+void DisplaySetGeometry(int mode);
+void DisplayPrepareScanline(int y, uint32_t *tmdsbuf);
+void DisplayInvalidate();
+int DisplayOpenScreen(int n);
+void DisplaySelectScreen(int n);
+void DisplayShowScreen(int n);
 void ClearTextDisplay();
 
 void PutCharacter(int c, int row, int col);
+void PutCharacters(const char *chars, int n, int row, int col);
 void SetAttribute(unsigned char a, int row, int col);
+void FillAttributes(uint8_t a, int row, int col, int n);
+void ClearCells(int row, int col, int n);
 void UnSetAttribute(unsigned char a, int row, int col);
+void SetColor(uint8_t color, int row, int col);
+void SetPenColor(uint8_t color);
+uint8_t GetPenColor();
+void SetPaletteColor(int index, uint8_t rgb332);
+void DisplayWriteRow(int row, const char *chars, const uint8_t *attrs, const uint8_t *colors, int n);
+size_t DisplayScreenBytes();
+void DisplaySaveScreen(uint8_t *buf);
+void DisplayRestoreScreen(const uint8_t *buf);
 
 void RenderTextScanline(int y);
+void RenderTextScanlineBuf(uint32_t *dst, int y);
+void RenderTextScanline1bpp(uint8_t *dst, int y);
+void ExpandPixels2bpp(uint32_t *dst, const uint8_t *src, int n);
+void ExpandPixels4bpp(uint32_t *dst, const uint8_t *src, int n);
+void RenderTextDisplay();
 
 void CharacterDisplayScrollUp();
+void CharacterDisplayScrollUpLines(int n);
 void CharacterDisplayScrollUpRow(int r);
 void CharacterDisplayScrollDownRow(int r);
 void CharacterDisplayScrollDownRange(int start_r, int end_r);
 void CharacterDisplayScrollUpRange(int start_r, int end_r);
+void CharacterDisplayScrollRegion(int top, int bottom, int n);
 
 // display.h
\ No newline at end of file
@@ -0,0 +1,182 @@
+// ----------------------------------------------------------------------------
+// display mode registry
+// every mode supplies a core1 scanline producer, the framebuffer memory it needs
+// and an optional enter hook. Switching modes frees the old framebuffer before
+// allocating the new one so the heap only ever holds one of them
+// ----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// picodvi
+#include "dvi.h"
+#include "tmds_encode.h"
+#include "sprite.h"
+
+#include "display.h"
+#include "scrollback.h"
+
+extern struct dvi_inst dvi0;
+
+// only allocated while a graphics mode is active
+uint8_t *FRAMEBUF = NULL;
+
+// scanline buffer for the text and palettised modes: 320 bytes at 8bpp, 80 bytes at 1bpp
+// sized for the widest geometry so a renderer that runs while DisplaySetMode() is
+// still switching geometry (one glitched scanline at most) cannot overrun it
+static uint32_t linebuf[D_CHAR_COLS_MAX * 8 / 4];
+
+static volatile int display_mode = D_MODE_TEXT;
+static volatile uint32_t scanline_count = 0;	// scanlines produced so far
+
+// 320 rgb332 pixels, horizontally doubled to 640
+static void __not_in_flash_func(_Encode8bpp)(const uint32_t *scanbuf, uint32_t *tmdsbuf) {
+	uint pixwidth = dvi0.timing->h_active_pixels;
+	uint words_per_channel = pixwidth / DVI_SYMBOLS_PER_WORD;
+	tmds_encode_data_channel_8bpp(scanbuf, tmdsbuf + 0 * words_per_channel, pixwidth / 2, DVI_8BPP_BLUE_MSB,  DVI_8BPP_BLUE_LSB );
+	tmds_encode_data_channel_8bpp(scanbuf, tmdsbuf + 1 * words_per_channel, pixwidth / 2, DVI_8BPP_GREEN_MSB, DVI_8BPP_GREEN_LSB);
+	tmds_encode_data_channel_8bpp(scanbuf, tmdsbuf + 2 * words_per_channel, pixwidth / 2, DVI_8BPP_RED_MSB,   DVI_8BPP_RED_LSB  );
+}
+
+// 640 monochrome pixels: encoded once and copied to all three channels
+static void __not_in_flash_func(_Encode1bpp)(const uint32_t *pixbuf, uint32_t *tmdsbuf) {
+	uint pixwidth = dvi0.timing->h_active_pixels;
+	uint words_per_channel = pixwidth / DVI_SYMBOLS_PER_WORD;
+	tmds_encode_1bpp(pixbuf, tmdsbuf, pixwidth);
+	memcpy(tmdsbuf + 1 * words_per_channel, tmdsbuf, words_per_channel * sizeof(uint32_t));
+	memcpy(tmdsbuf + 2 * words_per_channel, tmdsbuf, words_per_channel * sizeof(uint32_t));
+}
+
+// ----------------------------------------------------------------------------
+// SCANLINE PRODUCERS (core1)
+// ----------------------------------------------------------------------------
+
+static void __not_in_flash_func(_ScanlineText)(int y, uint32_t *tmdsbuf) {
+	RenderTextScanlineBuf(linebuf, y);
+	_Encode8bpp(linebuf, tmdsbuf);
+}
+
+static void __not_in_flash_func(_ScanlineText80)(int y, uint32_t *tmdsbuf) {
+	RenderTextScanline1bpp((uint8_t*)linebuf, y);
+	_Encode1bpp(linebuf, tmdsbuf);
+}
+
+static void __not_in_flash_func(_ScanlineRGB332)(int y, uint32_t *tmdsbuf) {
+	_Encode8bpp((const uint32_t*)&FRAMEBUF[D_FRAME_WIDTH * y], tmdsbuf);
+}
+
+static void __not_in_flash_func(_ScanlineBitmap)(int y, uint32_t *tmdsbuf) {
+	_Encode1bpp((const uint32_t*)&FRAMEBUF[(D_FRAME_WIDTH * 2 / 8) * y], tmdsbuf);
+}
+
+static void __not_in_flash_func(_ScanlinePal2)(int y, uint32_t *tmdsbuf) {
+	ExpandPixels2bpp(linebuf, &FRAMEBUF[(D_FRAME_WIDTH / 4) * y], D_FRAME_WIDTH / 4);
+	_Encode8bpp(linebuf, tmdsbuf);
+}
+
+static void __not_in_flash_func(_ScanlinePal4)(int y, uint32_t *tmdsbuf) {
+	ExpandPixels4bpp(linebuf, &FRAMEBUF[(D_FRAME_WIDTH / 2) * y], D_FRAME_WIDTH / 2);
+	_Encode8bpp(linebuf, tmdsbuf);
+}
+
+static void (*volatile scanline_producer)(int y, uint32_t *tmdsbuf) = _ScanlineText;
+
+// ----------------------------------------------------------------------------
+// ENTER HOOKS (core0)
+// ----------------------------------------------------------------------------
+
+static void _EnterRGB332() {
+	sprite_fill8(FRAMEBUF, 0x02, D_FRAME_WIDTH * D_FRAME_HEIGHT);
+	DisplayInvalidate();		// console will be redrawn into it if enabled
+}
+
+// ----------------------------------------------------------------------------
+// MODE TABLE
+// ----------------------------------------------------------------------------
+
+const struct DisplayMode DISPLAY_MODES[D_MODE_COUNT] = {
+	[D_MODE_TEXT]        = { "text 40x30",   320, 240, 40, 30,            0, 0,          _ScanlineText,   NULL },
+	[D_MODE_FRAMEBUFFER] = { "rgb332 8bpp",  320, 240, 40, 30,            8, 320*240,    _ScanlineRGB332, _EnterRGB332 },
+	[D_MODE_TEXT80]      = { "text 80x30",   640, 240, 80, D_TEXT80_ROWS, 0, 0,          _ScanlineText80, NULL },
+	[D_MODE_BITMAP]      = { "bitmap 1bpp",  640, 240, 40, 30,            1, 640*240/8,  _ScanlineBitmap, NULL },
+	[D_MODE_PAL2]        = { "palette 2bpp", 320, 240, 40, 30,            2, 320*240/4,  _ScanlinePal2,   NULL },
+	[D_MODE_PAL4]        = { "palette 4bpp", 320, 240, 40, 30,            4, 320*240/2,  _ScanlinePal4,   NULL },
+};
+const struct DisplayMode *D_MODE = &DISPLAY_MODES[D_MODE_TEXT];
+
+// called by core1 for every scanline it hands to the DVI DMA
+void __not_in_flash_func(DisplayPrepareScanline)(int y, uint32_t *tmdsbuf) {
+	scanline_producer(y, tmdsbuf);
+	scanline_count++;
+}
+
+int DisplayGetMode() {
+	return display_mode;
+}
+
+// park core1 on a producer that only reads the character screen and wait
+// until it has moved past whatever it was reading before
+static void _ParkScanout() {
+	scanline_producer = _ScanlineText;
+	uint32_t start = scanline_count;
+	while (scanline_count - start < 2)
+		tight_loop_contents();
+}
+
+// switch display modes (D_MODE_xxx)
+// returns 0 on success or -1 if the mode is invalid or there is not enough memory
+// for its framebuffer, in which case the display falls back to D_MODE_TEXT
+int DisplaySetMode(int mode) {
+	if (mode < 0 || mode >= D_MODE_COUNT)
+		return -1;
+	if (mode == display_mode)
+		return 0;
+
+	// the scrollback view holds a snapshot of the live screen in the old geometry
+	SB_ViewExit();
+
+	const struct DisplayMode *m = &DISPLAY_MODES[mode];
+
+	// hand the old framebuffer back first so switching between two graphics
+	// modes only needs the memory of the new one
+	if (FRAMEBUF) {
+		_ParkScanout();
+		display_mode = D_MODE_TEXT;
+		uint8_t *old_fb = FRAMEBUF;
+		FRAMEBUF = NULL;
+		free(old_fb);
+	}
+
+	uint8_t *fb = NULL;
+	if (m->fb_size) {
+		fb = malloc(m->fb_size);
+		if (!fb) {
+			DisplaySetGeometry(D_MODE_TEXT);
+			__dmb();
+			display_mode = D_MODE_TEXT;
+			scanline_producer = _ScanlineText;
+			return -1;
+		}
+		memset(fb, 0, m->fb_size);
+	}
+
+	// the console must have the new geometry before it gets drawn into a framebuffer
+	// and before core1 renders it at the new width
+	_ParkScanout();
+	DisplaySetGeometry(mode);
+	FRAMEBUF = fb;
+	if (m->enter)
+		m->enter();
+
+	__dmb();
+	display_mode = mode;
+	scanline_producer = m->scanline;
+	return 0;
+}
+
+// display_modes.c
@@ -30,6 +30,9 @@
 #include "display.h"
 #include "conio.h"
 #include "ed.h"
+#include "shell.h"
+#include "dircache.h"
+#include "sdreader.h"
 
 unsigned char ED_MODE = ED_BASICMODE;
 
@@ -161,6 +164,17 @@ static unsigned char _PromptFilename(char* fname, char *prompt) {
 	int c;
 	do {
 		c = getc(stdin);
+		if (c == 9) {		// TAB: complete the name from the directory cache
+			char add[ED_MAX_FILENAME + 1];
+			struct DirMatch m;
+			*cp = 0;
+			int n = DC_Complete(fname, add, ED_MAX_FILENAME + 1 - count, &m);
+			for (int i = 0; i < n; i++) {
+				*cp++ = add[i];
+				count++;
+				putc(add[i], stdout);
+			}
+		}
 		// FIXME: allowable characters should be way more limited than this I think
 		if ((c > 32 && c <= 122) || c == 8) {	// no spaces allowed, hence > 32
 			if (c == 8) {
@@ -240,6 +254,7 @@ static int _doSave() {
 				fprintf(fp, "%s\n", &CB->out_lines[line]);
 			}
 			fclose(fp);
+			DC_InvalidateFile(CB->source_filename);
 			return line;
 		}
 	}
@@ -249,21 +264,19 @@ static int _doSave() {
 // Load a basic source and add the lines to the m16basic core
 // returns number of lines loaded or negative error code
 static int _doLoad(char *filename) {
-	char buf[ED_LINE_MAX_CHARS+3];			// leave space for trailing \r and/or \n + 0
-	FILE* fp = fopen(filename, "r");
-	if (fp) {
+	static struct SDReader reader;
+	char buf[ED_LINE_MAX_CHARS+2];			// lines longer than this get split
+	if (SR_Open(&reader, filename) == FR_OK) {
 		int lines = 0;
-		// NOTE that fgets() reads a trailing 0x0D+0x0A (cr&lf) as a single LF!
-		// (at least the visual c std lib does)
-		while (fgets(buf, ED_LINE_MAX_CHARS+2, fp)) {
-			size_t len = strlen(buf);
-			if (buf[len - 1] == 10) buf[len - 1] = 0;	// remove any trailing newline characters
+		// line ends (LF or CR LF) get removed
+		while (SR_Gets(&reader, buf, sizeof(buf)) >= 0) {
 			lines++;
 			_addListLine(CB, buf);
 		}
-		fclose(fp);
+		SR_Close(&reader);
 		return lines;
 	}
+	SR_Close(&reader);
 	return -1;
 }
 
@@ -508,6 +521,11 @@ static int _Init() {
 
 	}
 
+	// adopt the current display geometry (lines stay limited to ED_LINE_MAX_CHARS)
+	W.n_cols = D_CHAR_COLS < ED_LINE_MAX_CHARS ? D_CHAR_COLS : ED_LINE_MAX_CHARS;
+	W.n_total_rows = D_CHAR_ROWS;
+	W.n_rows = W.status_row = D_CHAR_ROWS - 1;
+
     ClearTextDisplay();
 	e_ClearStatus();
 	e_SetExtraStatusTextTemp("[CTRL-b]-9: help");
@@ -720,4 +738,17 @@ int e_Edit(char* filename) {
 }
 
 
+// ED gets a console of its own (if there is one) so the shell screen survives it
+static void _ed_cmd(struct cmd_arg *args, int nargs) {
+	int con = ConGetCurrent();
+	ConSwitch(CON_EDITOR);
+	e_Edit(NULL);
+	ConSwitch(con);
+}
+
+// registers the ED shell command
+void e_Open() {
+	ShellRegisterCommand("ED", _ed_cmd, 0, 1, "ED [file]  - Edit [file]");
+}
+
 // ed.c
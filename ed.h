@@ -66,6 +66,7 @@ void e_PrintPage();
 void e_InsertLineBefore(int r);
 void e_RemoveLine(int r);
 int e_Edit(char* filename);
+void e_Open();
 
 // ed_edit.c
 void e_InsertLineBefore(int r);
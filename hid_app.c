@@ -25,9 +25,11 @@
 
 #include <ctype.h>
 
+#include "pico/stdlib.h"
 #include "bsp/board.h"
 #include "tusb.h"
 #include "conio.h"
+#include "input.h"
 
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
@@ -39,8 +41,6 @@
 
 #define MAX_REPORT  4
 
-static uint8_t const keycode2ascii[128][2] =  { HID_KEYCODE_TO_ASCII };
-
 // Each HID instance can has multiple reports
 static struct
 {
@@ -48,18 +48,15 @@ static struct
   tuh_hid_report_info_t report_info[MAX_REPORT];
 }hid_info[CFG_TUH_HID];
 
-static void process_kbd_report(hid_keyboard_report_t const *report);
+static void process_kbd_report(hid_keyboard_report_t const *report, uint64_t time_us);
 static void process_mouse_report(hid_mouse_report_t const * report);
-static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len);
+static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len, uint64_t time_us);
 
 void hid_app_task(void)
 {
   // nothing to do
 }
 
-extern void StartKeyRepeat(int k);
-extern void StopKeyRepeat();
-
 //--------------------------------------------------------------------+
 // TinyUSB Callbacks
 //--------------------------------------------------------------------+
@@ -104,13 +101,14 @@ void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
 // Invoked when received report from device via interrupt endpoint
 void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
 {
+  uint64_t const time_us = time_us_64();   // the key events' timestamp (input latency starts here)
   uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
 
   switch (itf_protocol)
   {
     case HID_ITF_PROTOCOL_KEYBOARD:
       TU_LOG2("HID receive boot keyboard report\r\n");
-      process_kbd_report( (hid_keyboard_report_t const*) report );
+      process_kbd_report( (hid_keyboard_report_t const*) report, time_us );
     break;
 
     case HID_ITF_PROTOCOL_MOUSE:
@@ -120,7 +118,7 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t cons
 
     default:
       // Generic report requires matching ReportID and contents with previous parsed report info
-      process_generic_report(dev_addr, instance, report, len);
+      process_generic_report(dev_addr, instance, report, len, time_us);
     break;
   }
 
@@ -146,12 +144,35 @@ static inline bool find_key_in_report(hid_keyboard_report_t const *report, uint8
   return false;
 }
 
-// one of these is received for any key press and release
-static void process_kbd_report(hid_keyboard_report_t const *report)
+// one of these is received for any key press and release: turned into input
+// events (see input.c), the console translates them into characters later on
+static void process_kbd_report(hid_keyboard_report_t const *report, uint64_t time_us)
 {
   static hid_keyboard_report_t prev_report = { 0, 0, {0} }; // previous report to check key released
 
   //printf("HID keyboard report\n");
+
+  // modifier keys come as bits: post them as their HID_KEY_CONTROL_LEFT.. keycodes
+  uint8_t const mod_changed = report->modifier ^ prev_report.modifier;
+  for(uint8_t b=0; b<8; b++)
+  {
+    if ( mod_changed & (1 << b) )
+    {
+      InputPostEvent(time_us, HID_KEY_CONTROL_LEFT + b, report->modifier, report->modifier & (1 << b), false);
+    }
+  }
+
+  for(uint8_t i=0; i<6; i++)
+  {
+    // test for released keys: will have been in last record but not in the current one
+    if(prev_report.keycode[i]) {
+      if (!find_key_in_report(report, prev_report.keycode[i]) ) {
+          InputPostEvent(time_us, prev_report.keycode[i], report->modifier, false, false);
+          InputRepeatStop(prev_report.keycode[i]);  // the key held before it takes over the repeat
+      }
+    }
+  }
+
   for(uint8_t i=0; i<6; i++)
   {
     if ( report->keycode[i] )
@@ -163,60 +184,14 @@ static void process_kbd_report(hid_keyboard_report_t const *report)
       }else
       {
         // not existed in previous report means the current key is pressed
-        bool const is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
-
-        uint8_t ch = keycode2ascii[report->keycode[i]][is_shift ? 1 : 0];
-
-        switch(report->keycode[i]) {
-          case HID_KEY_ARROW_LEFT:
-              ch = M16_CON_CURSOR_LEFT;
-              break;
-          case HID_KEY_ARROW_RIGHT:
-              //printf("Arrow right\n");
-              ch = M16_CON_CURSOR_RIGHT;
-              break;
-          case HID_KEY_ARROW_UP:
-              ch = M16_CON_CURSOR_UP;
-              break;
-          case HID_KEY_ARROW_DOWN:
-              ch = M16_CON_CURSOR_DOWN;
-              break;
-        } 
-        // not differentiating left/right ctrl or alt right now
-        //bool is_ctrl = report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL|KEYBOARD_MODIFIER_RIGHTCTRL);
-        if(report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL|KEYBOARD_MODIFIER_RIGHTCTRL)) {
-          switch(ch) {
-            case 'b':
-            case 'B':
-                ConStoreCharacter(M16_CON_CTRL_B);
-              break;
-            case 'q':
-            case 'Q':
-                ConStoreCharacter(M16_CON_CTRL_Q);
-              break;
-            case 's':
-            case 'S':
-                ConStoreCharacter(M16_CON_CTRL_S);
-              break;
-            case 'l':
-            case 'L':
-                ConStoreCharacter(M16_CON_CTRL_L);
-              break;
-          }
-        } else {
-          ConStoreCharacter(ch);  // ConStoreCharacter() does input validation: just pass in whatever
-          StartKeyRepeat(ch);
+        InputPostEvent(time_us, report->keycode[i], report->modifier, true, false);
+
+        // ctrl combos don't repeat
+        if(!(report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL|KEYBOARD_MODIFIER_RIGHTCTRL))) {
+          InputRepeatStart(report->keycode[i]);
         }
       }
     }
-    // test for released keys: will have been in last record but not in the current one
-    if(prev_report.keycode[i]) {
-      if (!find_key_in_report(report, prev_report.keycode[i]) ) {
-          // key release event
-          // printf("key release event\n");
-          StopKeyRepeat();  // stop any possibly ongoing key auto repeat
-      }
-    }
   }
 
   prev_report = *report;
@@ -283,7 +258,7 @@ static void process_mouse_report(hid_mouse_report_t const * report)
 //--------------------------------------------------------------------+
 // Generic Report
 //--------------------------------------------------------------------+
-static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
+static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len, uint64_t time_us)
 {
   (void) dev_addr;
 
@@ -334,7 +309,7 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
       case HID_USAGE_DESKTOP_KEYBOARD:
         TU_LOG1("HID receive keyboard report\r\n");
         // Assume keyboard follow boot report layout
-        process_kbd_report( (hid_keyboard_report_t const*) report );
+        process_kbd_report( (hid_keyboard_report_t const*) report, time_us );
       break;
 
       case HID_USAGE_DESKTOP_MOUSE:
@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "tusb.h"
+
+#include "conio.h"
+#include "input.h"
+#include "latency.h"
+
+#define QUEUE_MASK (INPUT_QUEUE_SIZE - 1)
+
+static struct InputEvent queue[INPUT_QUEUE_SIZE];
+static uint32_t head = 0;			// free running write index: only ever written by the producer
+static uint32_t tail = 0;			// free running read index: only ever written by the consumer (see _Drain())
+static uint32_t high_water = 0;		// most events pending at once
+static uint32_t dropped = 0;		// events lost because the queue was full
+static volatile bool raw = false;
+static uint8_t modifiers_now = 0;	// modifier state of the latest event
+static volatile int show_request = -1;	// console to show (alt-F1..F4), -1 none
+
+static uint8_t const keycode2ascii[128][2] = { HID_KEYCODE_TO_ASCII };
+
+static void _Drain();
+
+// queue an event (producer side). In cooked mode
+// the console translation takes it out again right away (see _Drain()).
+// Queueing fails if the queue is full: the event is counted as dropped
+void InputPostEvent(uint64_t time_us, uint8_t keycode, uint8_t modifiers, bool pressed, bool repeat) {
+	modifiers_now = modifiers;
+	uint32_t h = head;
+	uint32_t pending = h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+	if (pending >= INPUT_QUEUE_SIZE) {
+		dropped++;
+		return;
+	}
+	struct InputEvent *ev = &queue[h & QUEUE_MASK];
+	ev->time_us = time_us;
+	ev->keycode = keycode;
+	ev->modifiers = modifiers;
+	ev->pressed = pressed;
+	ev->repeat = repeat;
+	__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+	if (pending + 1 > high_water)
+		high_water = pending + 1;
+	if (!raw)
+		_Drain();
+	__sev();		// wake up InputWaitEvent()
+}
+
+// consumer side
+bool InputGetEvent(struct InputEvent *ev) {
+	uint32_t t = tail;
+	if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+		return false;
+	*ev = queue[t & QUEUE_MASK];
+	__atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// the event register latches a __sev() that comes in before the __wfe(),
+// so an event posted right after the check cannot be slept through
+void InputWaitEvent(struct InputEvent *ev) {
+	while (!InputGetEvent(ev))
+		__wfe();
+}
+
+int InputPending() {
+	return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+}
+
+// leaving raw mode drops the events the application did not read. Interrupts are
+// off while the consumer changes
+void InputSetRaw(bool on) {
+	uint32_t save = save_and_disable_interrupts();
+	raw = on;
+	if (!on)
+		__atomic_store_n(&tail, __atomic_load_n(&head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	restore_interrupts(save);
+}
+
+bool InputIsRaw() {
+	return raw;
+}
+
+void InputGetStats(unsigned *hw, unsigned *drop) {
+	*hw = high_water;
+	*drop = dropped;
+}
+
+// keys lost since the last call: events the queue had no room for plus
+// characters the console input streams had no room for
+unsigned InputTakeLost() {
+	static unsigned seen = 0;
+	unsigned total = dropped;
+	for (int n = 0; n < CON_COUNT; n++) {
+		unsigned hw, drop;
+		ConGetInputStats(n, &hw, &drop);
+		total += drop;
+	}
+	unsigned lost = total - seen;
+	seen = total;
+	return lost;
+}
+
+// ----------------------------------------------------------------------------
+// KEY AUTO REPEAT
+// driven by an alarm of its own: the first repeat comes repeat_delay ms after the
+// press, the following ones every repeat_rate ms measured from when the previous
+// one was due, so the rate does not drift with interrupt latency.
+// The most recent key held down repeats: releasing it hands the repeat back to
+// the one pressed before it, if that is still held (after the delay again).
+// The alarm runs in the same timer interrupt as the usb host path, which keeps
+// the event queue single producer
+// ----------------------------------------------------------------------------
+
+#define REPEAT_HELD_MAX 6			// a boot protocol report has 6 key slots
+
+static uint32_t repeat_delay = INPUT_REPEAT_DELAY_MS;
+static uint32_t repeat_rate = INPUT_REPEAT_RATE_MS;
+static uint8_t held[REPEAT_HELD_MAX];	// keys that may repeat in press order, the last one repeats
+static int nheld = 0;
+static uint8_t repeat_key = 0;			// key being repeated, 0 if none
+static alarm_id_t repeat_alarm = 0;
+
+static int64_t _RepeatAlarm(alarm_id_t id, void *user_data) {
+	if (!repeat_key) {
+		repeat_alarm = 0;
+		return 0;
+	}
+	InputPostEvent(time_us_64(), repeat_key, modifiers_now, true, true);
+	return -(int64_t)repeat_rate * 1000;	// negative: relative to when this one was due
+}
+
+static void _RepeatCancel() {
+	repeat_key = 0;
+	if (repeat_alarm) {
+		cancel_alarm(repeat_alarm);
+		repeat_alarm = 0;
+	}
+}
+
+// repeat the most recent held key, starting over with the delay
+static void _RepeatArm() {
+	_RepeatCancel();
+	if (!nheld || !repeat_rate)
+		return;
+	repeat_key = held[nheld - 1];
+	alarm_id_t id = add_alarm_in_ms(repeat_delay, _RepeatAlarm, NULL, true);
+	repeat_alarm = id > 0 ? id : 0;
+	if (!repeat_alarm)
+		repeat_key = 0;
+}
+
+// drop keycode from the held keys, false if it was not there
+static bool _Release(uint8_t keycode) {
+	for (int i = 0; i < nheld; i++) {
+		if (held[i] == keycode) {
+			nheld--;
+			for (; i < nheld; i++)
+				held[i] = held[i + 1];
+			return true;
+		}
+	}
+	return false;
+}
+
+// the most recently pressed key repeats (called on every key press)
+void InputRepeatStart(uint8_t keycode) {
+	_Release(keycode);
+	if (nheld == REPEAT_HELD_MAX)
+		_Release(held[0]);
+	held[nheld++] = keycode;
+	_RepeatArm();
+}
+
+// called on every key release: if it was the key repeating, the most recent
+// key still held takes over (0 releases all keys)
+void InputRepeatStop(uint8_t keycode) {
+	if (!keycode) {
+		nheld = 0;
+		_RepeatCancel();
+		return;
+	}
+	if (_Release(keycode) && keycode == repeat_key)
+		_RepeatArm();
+}
+
+// delay before the first repeat and time between repeats, rate 0 turns repeat off
+void InputSetRepeat(uint32_t delay_ms, uint32_t rate_ms) {
+	uint32_t save = save_and_disable_interrupts();	// the usb host path may be starting one
+	repeat_delay = delay_ms;
+	repeat_rate = rate_ms;
+	_RepeatArm();
+	restore_interrupts(save);
+}
+
+void InputGetRepeat(uint32_t *delay_ms, uint32_t *rate_ms) {
+	*delay_ms = repeat_delay;
+	*rate_ms = repeat_rate;
+}
+
+// ----------------------------------------------------------------------------
+// LATENCY
+// time from tuh_hid_report_received_cb() (the event timestamp) to the console
+// reading the character: the usb host path, the event queue, the console input
+// stream and however long the main loop takes to ask for input. Key presses are
+// sampled, one per console at a time (ConStoreKey()), repeats are left out.
+// Power of two buckets
+// ----------------------------------------------------------------------------
+
+static uint32_t latency_hist[INPUT_LATENCY_BUCKETS];
+static uint32_t latency_max = 0;
+
+// main loop (Con_getc())
+void InputRecordLatency(uint64_t time_us) {
+	uint64_t d = time_us_64() - time_us;
+	uint32_t us = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+	int b = us ? 31 - __builtin_clz(us) : 0;
+	if (b >= INPUT_LATENCY_BUCKETS)
+		b = INPUT_LATENCY_BUCKETS - 1;
+	latency_hist[b]++;
+	if (us > latency_max)
+		latency_max = us;
+}
+
+// hist gets INPUT_LATENCY_BUCKETS counts: bucket b holds latencies of 2^b to 2^(b+1)-1 us
+// (bucket 0 includes 0, the last one everything above)
+void InputGetLatency(uint32_t *hist, uint32_t *max_us) {
+	for (int b = 0; b < INPUT_LATENCY_BUCKETS; b++)
+		hist[b] = latency_hist[b];
+	*max_us = latency_max;
+}
+
+void InputClearLatency() {
+	for (int b = 0; b < INPUT_LATENCY_BUCKETS; b++)
+		latency_hist[b] = 0;
+	latency_max = 0;
+}
+
+// ----------------------------------------------------------------------------
+// CONSOLE INPUT
+// ----------------------------------------------------------------------------
+
+int InputTranslate(const struct InputEvent *ev) {
+	if (!ev->pressed || ev->keycode >= 128)
+		return 0;
+
+	bool const is_shift = ev->modifiers & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+	int ch = keycode2ascii[ev->keycode][is_shift ? 1 : 0];
+
+	switch (ev->keycode) {
+	case HID_KEY_ARROW_LEFT:	ch = M16_CON_CURSOR_LEFT; break;
+	case HID_KEY_ARROW_RIGHT:	ch = M16_CON_CURSOR_RIGHT; break;
+	case HID_KEY_ARROW_UP:		ch = M16_CON_CURSOR_UP; break;
+	case HID_KEY_ARROW_DOWN:	ch = M16_CON_CURSOR_DOWN; break;
+	case HID_KEY_HOME:			ch = M16_CON_HOME; break;
+	case HID_KEY_END:			ch = M16_CON_END; break;
+	case HID_KEY_PAGE_UP:		ch = M16_CON_PGUP; break;
+	case HID_KEY_PAGE_DOWN:		ch = M16_CON_PGDOWN; break;
+	}
+
+	// not differentiating left/right ctrl right now
+	if (ev->modifiers & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL)) {
+		switch (ch) {
+		case 'b': case 'B':	return M16_CON_CTRL_B;
+		case 'q': case 'Q':	return M16_CON_CTRL_Q;
+		case 's': case 'S':	return M16_CON_CTRL_S;
+		case 'l': case 'L':	return M16_CON_CTRL_L;
+		case 'r': case 'R':	return M16_CON_CTRL_R;
+		default:			return 0;
+		}
+	}
+	return ch;
+}
+
+// cooked mode: key presses become console input. Releases and modifier keys
+// are not needed
+static void _Cooked(const struct InputEvent *ev) {
+	if (ev->pressed && (ev->modifiers & (KEYBOARD_MODIFIER_LEFTALT | KEYBOARD_MODIFIER_RIGHTALT)) &&
+		ev->keycode >= HID_KEY_F1 && ev->keycode < HID_KEY_F1 + CON_COUNT) {
+		// alt-F1..F4: the keys that follow go to the other console at once,
+		// showing it waits for the main loop (InputPump())
+		ConInputTo(ev->keycode - HID_KEY_F1);
+		show_request = ev->keycode - HID_KEY_F1;
+		return;
+	}
+	int c = InputTranslate(ev);
+	if (c) {
+		if (ev->repeat)
+			ConStoreCharacter(c);	// does input validation
+		else {
+			LAT_KeyPressed(ev->time_us);
+			ConStoreKey(c, ev->time_us);
+		}
+	}
+}
+
+// the console translation is the queue's consumer in cooked mode: it runs in
+// the usb timer interrupt after every post, so a main loop that is busy for a
+// while loses nothing. Events wait in the queue while the console input stream
+// is full, InputPump() picks them up once the main loop has read some.
+// Raw mode readers never run at the same time: the mode only changes with
+// interrupts off (InputSetRaw())
+static void _Drain() {
+	struct InputEvent ev;
+	while (ConInputRoom() && InputGetEvent(&ev))
+		_Cooked(&ev);
+}
+
+// called by the console whenever it looks for input: runs in the main loop,
+// so console switching never interrupts output half way
+void InputPump() {
+	uint32_t save = save_and_disable_interrupts();
+	if (!raw)
+		_Drain();
+	int n = show_request;
+	show_request = -1;
+	restore_interrupts(save);
+	if (n >= 0 && ConShow(n) != 0)
+		ConInputTo(ConGetVisible());	// no room for its screen: input goes back
+}
+
+// input.c
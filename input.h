@@ -0,0 +1,79 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * INPUT EVENTS
+ * every key press and release (modifier keys included) is queued
+ * with its HID keycode, the modifier state and a timestamp.
+ * The queue is a lock-free single producer / single consumer ring:
+ * the usb host path writes, the console or the application reads.
+ *
+ * Normally the console is the consumer: presses get translated
+ * into characters and meta codes for its input stream as soon as
+ * they are queued (still in the usb host path). In raw mode the
+ * events stay queued for the application (editor, lua, games) to read
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// must be a power of two
+#ifndef INPUT_QUEUE_SIZE
+#define INPUT_QUEUE_SIZE 64
+#endif
+
+#if INPUT_QUEUE_SIZE & (INPUT_QUEUE_SIZE - 1)
+#error INPUT_QUEUE_SIZE must be a power of two
+#endif
+
+// key auto repeat defaults
+#ifndef INPUT_REPEAT_DELAY_MS
+#define INPUT_REPEAT_DELAY_MS 600
+#endif
+#ifndef INPUT_REPEAT_RATE_MS
+#define INPUT_REPEAT_RATE_MS 40
+#endif
+
+// report to console read latency histogram: power of two buckets from 1us
+#define INPUT_LATENCY_BUCKETS 16
+
+struct InputEvent {
+	uint64_t time_us;		// time_us_64() when the keyboard report arrived (repeats: when posted)
+	uint8_t keycode;		// HID usage id (HID_KEY_xxx, modifier keys are 0xe0..0xe7)
+	uint8_t modifiers;		// HID modifier bits (KEYBOARD_MODIFIER_xxx) at that time
+	uint8_t pressed;		// 1 press, 0 release
+	uint8_t repeat;			// 1 if synthesised by key auto repeat
+};
+
+// producer side (usb host path and key auto repeat)
+void InputPostEvent(uint64_t time_us, uint8_t keycode, uint8_t modifiers, bool pressed, bool repeat);
+
+// key auto repeat (posts presses flagged as repeat): the most recent key still
+// held repeats. Start on a press of a key that may repeat, stop on every release
+void InputRepeatStart(uint8_t keycode);
+void InputRepeatStop(uint8_t keycode);
+void InputSetRepeat(uint32_t delay_ms, uint32_t rate_ms);
+void InputGetRepeat(uint32_t *delay_ms, uint32_t *rate_ms);
+
+// consumer side
+bool InputGetEvent(struct InputEvent *ev);		// false if the queue is empty
+void InputWaitEvent(struct InputEvent *ev);		// sleeps until there is one
+int InputPending();
+
+// raw mode: queue events instead of translating them into console input
+void InputSetRaw(bool raw);
+bool InputIsRaw();
+
+// main loop side of the console input: translates what waited for room in the
+// console input stream and shows the console alt-F1..F4 asked for
+void InputPump();
+
+// character or meta code (M16_CON_xxx) of a key press, 0 if there is none
+int InputTranslate(const struct InputEvent *ev);
+
+void InputGetStats(unsigned *high_water, unsigned *dropped);
+unsigned InputTakeLost();		// keys lost since the last call
+void InputRecordLatency(uint64_t time_us);		// the console read a key reported at time_us
+void InputGetLatency(uint32_t *hist, uint32_t *max_us);
+void InputClearLatency();
+
+// input.h
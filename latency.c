@@ -0,0 +1,105 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "display.h"
+#include "latency.h"
+
+volatile uint8_t lat_state = LAT_IDLE;
+volatile int lat_scanline = -1;
+
+// probe timestamps: t_key and t_glyph are written by core0, t_scan by core1
+static uint64_t t_key, t_glyph;
+static volatile uint64_t t_scan;
+
+static uint32_t samples[LAT_STAGE_COUNT][LAT_SAMPLES];
+static uint32_t nsamples = 0;		// samples taken so far (the ring holds the last LAT_SAMPLES)
+
+static inline uint32_t _Us(uint64_t d) {
+	return d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+}
+
+// store the figures of a finished probe (core0: the main loop and the keyboard
+// interrupt path both get here, hence the interrupts off)
+static void _Collect() {
+	if (__atomic_load_n(&lat_state, __ATOMIC_ACQUIRE) != LAT_DONE)
+		return;
+	uint32_t save = save_and_disable_interrupts();
+	if (lat_state == LAT_DONE) {
+		uint32_t i = nsamples % LAT_SAMPLES;
+		samples[LAT_STAGE_INPUT][i] = _Us(t_glyph - t_key);
+		samples[LAT_STAGE_SCANOUT][i] = _Us(t_scan - t_glyph);
+		samples[LAT_STAGE_TOTAL][i] = _Us(t_scan - t_key);
+		nsamples++;
+		lat_state = LAT_IDLE;
+	}
+	restore_interrupts(save);
+}
+
+// a key press got translated into console input (keyboard interrupt path):
+// follow it unless a probe is in flight
+void LAT_KeyPressed(uint64_t time_us) {
+	_Collect();
+	if (lat_state == LAT_IDLE || lat_state == LAT_KEY) {
+		t_key = time_us;
+		lat_state = LAT_KEY;
+	}
+}
+
+// the first character screen write after the key press. Only the text modes render
+// straight from the character screen, in the others the probe is dropped
+void LAT_GlyphWritten(int row) {
+	uint64_t now = time_us_64();
+	if (now - t_key > LAT_TIMEOUT_US || D_MODE->bpp) {
+		lat_state = LAT_IDLE;
+		return;
+	}
+	t_glyph = now;
+	lat_state = LAT_ARMED;
+	__atomic_store_n(&lat_scanline, row * D_FONT_HEIGHT, __ATOMIC_RELEASE);
+}
+
+// core1: the first scanline of the row has been handed to the DVI queue
+// (if core1 was rendering that very scanline while it got armed this is one frame early)
+void __not_in_flash_func(LAT_ScanlineDone)() {
+	if (lat_state != LAT_ARMED)
+		return;
+	t_scan = time_us_64();
+	lat_scanline = -1;
+	__atomic_store_n(&lat_state, LAT_DONE, __ATOMIC_RELEASE);
+}
+
+void LAT_GetStats(int stage, struct LatencyStats *st) {
+	static uint32_t sorted[LAT_SAMPLES];
+
+	_Collect();
+	memset(st, 0, sizeof(*st));
+	uint32_t n = nsamples < LAT_SAMPLES ? nsamples : LAT_SAMPLES;
+	if (stage < 0 || stage >= LAT_STAGE_COUNT || !n)
+		return;
+
+	// insertion sort: at most LAT_SAMPLES values
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t v = samples[stage][i];
+		uint32_t j = i;
+		for (; j > 0 && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+		sum += v;
+	}
+	st->count = n;
+	st->min = sorted[0];
+	st->max = sorted[n - 1];
+	st->avg = sum / n;
+	st->p99 = sorted[(n * 99 + 99) / 100 - 1];
+}
+
+void LAT_Clear() {
+	_Collect();
+	nsamples = 0;
+}
+
+// latency.c
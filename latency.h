@@ -0,0 +1,59 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * KEYPRESS TO PHOTON LATENCY
+ * one key press at a time is followed through three points:
+ * the keyboard report (the input event timestamp), the first
+ * character written to the visible screen after it and core1
+ * handing the first scanline of that row to the DVI queue.
+ * The last LAT_SAMPLES of every stage are kept
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+
+#ifndef LAT_SAMPLES
+#define LAT_SAMPLES 128
+#endif
+
+// a key press that did not put anything on screen within this time is not followed any further
+#define LAT_TIMEOUT_US 250000
+
+#define LAT_STAGE_INPUT		0	// report -> glyph in the character screen (usb, shell/ED processing)
+#define LAT_STAGE_SCANOUT	1	// glyph -> scanline handed to DVI (rendering)
+#define LAT_STAGE_TOTAL		2
+#define LAT_STAGE_COUNT		3
+
+// probe states
+#define LAT_IDLE	0
+#define LAT_KEY		1		// waiting for the glyph (core0)
+#define LAT_ARMED	2		// waiting for the scanline (core1)
+#define LAT_DONE	3		// waiting to be collected (core0)
+
+extern volatile uint8_t lat_state;
+extern volatile int lat_scanline;		// scanline core1 is waiting for, -1 if none
+
+void LAT_KeyPressed(uint64_t time_us);
+void LAT_GlyphWritten(int row);
+void LAT_ScanlineDone();
+
+// called for every write to the visible character screen (core0)
+static inline void LAT_Glyph(int row) {
+	if (lat_state == LAT_KEY)
+		LAT_GlyphWritten(row);
+}
+
+// called for every scanline handed to the DVI queue (core1)
+static inline void LAT_Scanline(int y) {
+	if (y == lat_scanline)
+		LAT_ScanlineDone();
+}
+
+struct LatencyStats {
+	uint32_t count;			// samples the figures are based on
+	uint32_t min, avg, p99, max;	// us
+};
+
+void LAT_GetStats(int stage, struct LatencyStats *st);
+void LAT_Clear();
+
+// latency.h
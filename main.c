@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <malloc.h>
 
 #include "pico/stdlib.h"
@@ -50,7 +51,10 @@
 #include "display.h"
 #include "conio.h"
 #include "shell.h"
+#include "ed.h"
 #include "sdcard.h"
+#include "latency.h"
+#include "uartcon.h"
 
 // TMDS bit clock 252 MHz
 // DVDD 1.2V (1.1V seems ok too)
@@ -63,37 +67,28 @@ struct dvi_inst dvi0;
 struct semaphore dvi_start_sem;
 
 /******************************************************************************
- * CORE1  code for 320x240 8bit rgb332 graphics mode
+ * CORE1  code: produces the TMDS encoded scanlines for the current display mode
+ * (the per mode scanline producers live in display_modes.c)
  */
 
-uint8_t FRAMEBUF[D_FRAME_WIDTH * D_FRAME_HEIGHT];
-
 void core1_main() {
 	dvi_register_irqs_this_core(&dvi0, DMA_IRQ_0);
 	sem_acquire_blocking(&dvi_start_sem);
 	dvi_start(&dvi0);
-	dvi_scanbuf_main_8bpp(&dvi0);
 
+	// we encode every scanline ourselves (no libdvi scanbuf loop) so the encoder 
+	// can differ between display modes
+	// DVI_VERTICAL_REPEAT (2) turns each of these into two display lines
 	while (1) {
-		__wfi();
-    }
+		for (uint y = 0; y < D_FRAME_HEIGHT; y++) {
+			uint32_t *tmdsbuf;
+			queue_remove_blocking_u32(&dvi0.q_tmds_free, &tmdsbuf);
+			DisplayPrepareScanline(y, tmdsbuf);
+			queue_add_blocking_u32(&dvi0.q_tmds_valid, &tmdsbuf);
+			LAT_Scanline(y);
+		}
+	}
 	__builtin_unreachable();
-
-}
-
-void core1_scanline_callback() {
-	// Note first two scanlines are pushed before DVI start
-	static uint scanline = 2;
-	
-	// Discard any scanline pointers passed back
-	uint8_t *bufptr;
-	while (queue_try_remove_u32(&dvi0.q_colour_free, &bufptr))
-		;
-
-	//RenderTextScanline(scanline);
-	bufptr = &FRAMEBUF[D_FRAME_WIDTH * scanline];
-	queue_add_blocking_u32(&dvi0.q_colour_valid, &bufptr);
-	scanline = (scanline + 1) % D_FRAME_HEIGHT;
 }
 
 
@@ -102,40 +97,30 @@ void core1_scanline_callback() {
  */
 
 
-static uint64_t framecount = 0;
-static uint64_t auto_repeat_timer;
-static int auto_repeat_key = 0;
-
-void StartKeyRepeat(int k) {
-	auto_repeat_key = k;
-	auto_repeat_timer = framecount;
-}
-
-void StopKeyRepeat() {
-	auto_repeat_key = 0;
-}
-
 bool RENDER_CONSOLE = 0;
 
 // 50hz regular updates
 bool display_timer_callback(__unused struct repeating_timer *t) {
     //printf("Repeat at %lld\n", time_us_64());
 
-	if(RENDER_CONSOLE) {
-		for(int scanline = 0; scanline < D_FRAME_HEIGHT; scanline++)
-			RenderTextScanline(scanline);
-	}
-
-   	tuh_task();
-
-	if(auto_repeat_key && (framecount > auto_repeat_timer  + 30) && (framecount % 2)) {
-		ConStoreCharacter(auto_repeat_key);
+	// text modes are rendered on core1 straight from the character screen: only the
+	// rgb332 framebuffer mode needs the console drawn into FRAMEBUF (if it is shown at all)
+	if(RENDER_CONSOLE || DisplayGetMode() != D_MODE_FRAMEBUFFER) {
+		RenderTextDisplay();	// only redraws rows that changed
 	}
-
-	framecount++;
     return true;
 }
 
+// 1khz usb host servicing: keyboard reports don't wait for the display tick
+// (both timers run in the same alarm interrupt, so they never preempt each other).
+// The uart bridge input is picked up here too: this interrupt is the one
+// producer of the console input streams
+bool usb_timer_callback(__unused struct repeating_timer *t) {
+	tuh_task();
+	UC_Poll();
+	return true;
+}
+
 void spi_receive_isr() {
 		uint32_t spi_data;
 		int bytes_read = spi_read_blocking(SPI_PORT, 0x00, (uint8_t*)&spi_data, 3);
@@ -143,7 +128,7 @@ void spi_receive_isr() {
 		uint16_t addr = ((spi_data & 0x00ffff00) >> 8);
 		uint16_t offset = addr - 16384;
 
-		if(offset >= 6144)
+		if(offset >= 6144 || !FRAMEBUF || DisplayGetMode() != D_MODE_FRAMEBUFFER)
 			return;
 
 #if 1
@@ -235,21 +220,11 @@ int __not_in_flash("main") main() {
 
 	dvi0.timing = &DVI_TIMING;
 	dvi0.ser_cfg = DVI_DEFAULT_SERIAL_CONFIG;
-	dvi0.scanline_callback = core1_scanline_callback;
 	dvi_init(&dvi0, next_striped_spin_lock_num(), next_striped_spin_lock_num());
 
-	// Once we've given core 1 the framebuffer, it will just keep on displaying
-	// it without any intervention from core 0
-	sprite_fill8((uint8_t*)FRAMEBUF, 0x02, D_FRAME_WIDTH * D_FRAME_HEIGHT);
-
-	// need to pass in the first two scan lines before we start the encoder on core1
-	// or the display won't sync, still don't understand why
-#if 1
-	uint8_t *bufptr = FRAMEBUF;
-	queue_add_blocking_u32(&dvi0.q_colour_valid, &bufptr);
-	bufptr += D_FRAME_WIDTH;
-	queue_add_blocking_u32(&dvi0.q_colour_valid, &bufptr);
-#endif
+	// we start out in text mode: core1 renders the character screen by itself 
+	// without any intervention from core 0 and no framebuffer is needed
+	DisplayOpen();
 
 	// start core1 renderer
 	printf("Core 1 start\n");
@@ -267,20 +242,25 @@ int __not_in_flash("main") main() {
     printf("Free heap after init: %d\n", P_GetFreeHeap());
 	printf("Start rendering\n");
 
-	DisplayOpen();
 	ConOpen();
+	ShellOpen();
+	UC_Open();			// console bridge on uart1
+	e_Open();
 
 	// SPI
 	init_spi();
+	SD_Open();
 
 	//sd_init_driver();
 	Con_printf("Picolo System v%s\n%d bytes free \n", PLATFORM_VERSION_STRING, P_GetFreeHeap());
 	//Con_printf("card free:%ldMB\n", SDCardTest()/(1024*1024));
 	Con_puts("ready\n");
 
-	// drive text display and tuh at 50hz
+	// drive text display at 50hz and tuh at 1khz
     struct repeating_timer timer;
     add_repeating_timer_ms(-20, display_timer_callback, NULL, &timer);
+    struct repeating_timer usb_timer;
+    add_repeating_timer_us(-1000, usb_timer_callback, NULL, &usb_timer);
 
 	while (1) {
 
@@ -295,6 +275,7 @@ int __not_in_flash("main") main() {
 
 #endif
 
+		SD_Task();
 		char *line = ShellReadInput();	// does not block
 		if(line) {
 			// might start a shell process (such as editor) and not return for duration
@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "display.h"
+#include "conio.h"
+#include "scrollback.h"
+
+// every line is stored as [len][len characters][len] so the ring can be walked
+// in both directions. Lines never wrap: a row wider than the screen is cut
+static uint8_t ring[SB_BUFFER_SIZE];
+static int head = 0;		// where the next line gets written
+static int tail = 0;		// start of the oldest line
+static int used = 0;		// bytes in use
+static int nlines = 0;
+
+// copy n bytes into the ring at offset off, wrapping around the end
+static void _RingPut(int off, const void *src, int n) {
+	int first = SB_BUFFER_SIZE - off;
+	if (first >= n) {
+		memcpy(ring + off, src, n);
+	} else {
+		memcpy(ring + off, src, first);
+		memcpy(ring, (const uint8_t*)src + first, n - first);
+	}
+}
+
+static void _RingGet(int off, void *dst, int n) {
+	int first = SB_BUFFER_SIZE - off;
+	if (first >= n) {
+		memcpy(dst, ring + off, n);
+	} else {
+		memcpy(dst, ring + off, first);
+		memcpy((uint8_t*)dst + first, ring, n - first);
+	}
+}
+
+static inline int _Wrap(int off) {
+	if (off >= SB_BUFFER_SIZE) return off - SB_BUFFER_SIZE;
+	if (off < 0) return off + SB_BUFFER_SIZE;
+	return off;
+}
+
+// store one character row: O(n), called by CharacterDisplayScrollUp() for the
+// row that leaves the screen
+void SB_Append(const char *chars, int n) {
+	while (n > 0 && chars[n - 1] == ' ')
+		n--;
+	if (n > 255)
+		n = 255;
+
+	// make room by dropping the oldest lines
+	int size = n + 2;
+	while (SB_BUFFER_SIZE - used < size) {
+		int len = ring[tail];
+		tail = _Wrap(tail + len + 2);
+		used -= len + 2;
+		nlines--;
+	}
+
+	ring[head] = n;
+	_RingPut(_Wrap(head + 1), chars, n);
+	ring[_Wrap(head + 1 + n)] = n;
+	head = _Wrap(head + size);
+	used += size;
+	nlines++;
+}
+
+void SB_Clear() {
+	head = tail = used = nlines = 0;
+}
+
+int SB_GetLineCount() {
+	return nlines;
+}
+
+// ----------------------------------------------------------------------------
+// VIEWING
+// the live screen is saved while paging through the history and restored
+// when leaving the view. Like the history itself this belongs to the shell console
+// ----------------------------------------------------------------------------
+
+static int view = 0;			// lines scrolled back, 0 means not viewing
+static uint8_t *saved = NULL;	// the live screen (see DisplaySaveScreen())
+static size_t saved_bytes = 0;	// its size: the geometry may have changed since
+
+// returns the ring offset of history line index (0 = oldest)
+static int _FindLine(int index) {
+	int off;
+	if (index < nlines / 2) {
+		off = tail;
+		while (index--)
+			off = _Wrap(off + ring[off] + 2);
+	} else {
+		off = head;
+		for (int i = nlines; i > index; i--)
+			off = _Wrap(off - ring[_Wrap(off - 1)] - 2);
+	}
+	return off;
+}
+
+// paint the screen with the history and live screen lines visible at the current
+// view position: the history is followed seamlessly by the saved live screen
+static void _Paint() {
+	int rows = D_CHAR_ROWS;
+	int cols = D_CHAR_COLS;
+	int cells = rows * cols;
+	int top = nlines - view;
+	int off = _FindLine(top);
+	char line[256];
+
+	for (int r = 0; r < rows; r++) {
+		int v = top + r;
+		if (v < nlines) {
+			int len = ring[off];
+			_RingGet(_Wrap(off + 1), line, len);
+			DisplayWriteRow(r, line, NULL, NULL, len < cols ? len : cols);
+			off = _Wrap(off + len + 2);
+		} else {
+			int sr = v - nlines;
+			DisplayWriteRow(r, (const char*)saved + sr * cols, saved + cells + sr * cols,
+				saved + 2 * cells + sr * cols, cols);
+		}
+	}
+}
+
+void SB_PageUp() {
+	if (view == nlines || ConGetCurrent() != CON_SHELL)
+		return;
+	if (!view) {
+		if (saved_bytes != DisplayScreenBytes()) {
+			free(saved);
+			saved = malloc(DisplayScreenBytes());
+			saved_bytes = saved ? DisplayScreenBytes() : 0;
+		}
+		if (!saved)
+			return;
+		UnDrawCursor();
+		DisplaySaveScreen(saved);
+	}
+	view += D_CHAR_ROWS - 1;
+	if (view > nlines)
+		view = nlines;
+	_Paint();
+}
+
+void SB_PageDown() {
+	if (!view || ConGetCurrent() != CON_SHELL)
+		return;
+	view -= D_CHAR_ROWS - 1;
+	if (view <= 0)
+		SB_ViewExit();
+	else
+		_Paint();
+}
+
+// back to the live screen without releasing the snapshot memory (the console
+// echo does this, see _Echo() in conio.c)
+void SB_ViewLeave() {
+	if (!view)
+		return;
+	int current = ConGetCurrent();
+	ConSelect(CON_SHELL);
+	DisplayRestoreScreen(saved);
+	view = 0;
+	DrawCursor();
+	ConSelect(current);
+}
+
+// back to the live screen
+void SB_ViewExit() {
+	SB_ViewLeave();
+	free(saved);
+	saved = NULL;
+	saved_bytes = 0;
+}
+
+int SB_IsViewing() {
+	return view != 0;
+}
+
+// scrollback.c
@@ -0,0 +1,25 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * CONSOLE SCROLLBACK
+ * rows scrolled off the top of the character screen are kept
+ * (trailing spaces trimmed) in a ring of SB_BUFFER_SIZE bytes:
+ * the oldest lines get dropped when it is full
+ * ------------------------------------------------------*/
+
+#ifndef SB_BUFFER_SIZE
+#define SB_BUFFER_SIZE 4096
+#endif
+
+void SB_Append(const char *chars, int n);
+void SB_Clear();
+int SB_GetLineCount();
+
+// viewing from the shell prompt
+void SB_PageUp();
+void SB_PageDown();
+void SB_ViewLeave();
+void SB_ViewExit();
+int SB_IsViewing();
+
+// scrollback.h
@@ -0,0 +1,290 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ff.h"
+#include "sd_card.h"
+#include "sdcache.h"
+
+#define SECTOR_SIZE 512
+
+struct Slot {
+	uint64_t sector;
+	uint32_t last_use;			// 0: free
+	uint8_t pinned;
+	uint8_t dirty;
+};
+
+static struct Slot *slots = NULL;
+static uint8_t *data = NULL;
+static int nslots = 0;
+static bool sized = false;
+static bool write_back = false;
+static uint32_t use_clock = 0;
+
+// the driver's own functions
+static sd_card_t *card = NULL;
+static block_dev_err_t (*card_read)(sd_card_t *, uint8_t *, uint64_t, uint32_t);
+static block_dev_err_t (*card_write)(sd_card_t *, const uint8_t *, uint64_t, uint32_t);
+static block_dev_err_t (*card_sync)(sd_card_t *);
+
+static uint64_t pin_start = 0, pin_end = 0;	// FAT (and FAT12/16 root directory) sectors
+static uint32_t fat_writes = 0;
+
+static struct SectorCacheStats stats;
+
+static inline uint8_t *_Data(int s) {
+	return data + (uint32_t)s * SECTOR_SIZE;
+}
+
+static int _Lookup(uint64_t sector) {
+	for (int i = 0; i < nslots; i++)
+		if (slots[i].last_use && slots[i].sector == sector)
+			return i;
+	return -1;
+}
+
+static block_dev_err_t _WriteOut(int s) {
+	block_dev_err_t err = card_write(card, _Data(s), slots[s].sector, 1);
+	if (err == SD_BLOCK_DEVICE_ERROR_NONE) {
+		stats.card_written += SECTOR_SIZE;
+		slots[s].dirty = 0;
+		stats.dirty--;
+	}
+	return err;
+}
+
+// the slot for a new sector: a free one, else the least recently used file data.
+// FAT sectors get at most half of the slots (at least one), beyond that they
+// replace each other
+static int _Victim(bool pinned) {
+	int lru = -1, lru_pinned = -1;
+	for (int i = 0; i < nslots; i++) {
+		if (!slots[i].last_use)
+			return i;
+		if (slots[i].pinned) {
+			if (lru_pinned < 0 || slots[i].last_use < slots[lru_pinned].last_use)
+				lru_pinned = i;
+		}
+		else if (lru < 0 || slots[i].last_use < slots[lru].last_use)
+			lru = i;
+	}
+	uint32_t quota = nslots > 1 ? nslots / 2 : 1;
+	if (pinned && lru_pinned >= 0 && stats.pinned >= quota)
+		return lru_pinned;
+	return lru >= 0 ? lru : lru_pinned;
+}
+
+static int _Insert(uint64_t sector, block_dev_err_t *err) {
+	bool pinned = sector >= pin_start && sector < pin_end;
+	int s = _Victim(pinned);
+	*err = SD_BLOCK_DEVICE_ERROR_NONE;
+	if (slots[s].last_use) {
+		if (slots[s].dirty && (*err = _WriteOut(s)) != SD_BLOCK_DEVICE_ERROR_NONE)
+			return -1;
+		stats.pinned -= slots[s].pinned;
+		stats.evictions++;
+	}
+	slots[s].sector = sector;
+	slots[s].last_use = ++use_clock;
+	slots[s].pinned = pinned;
+	slots[s].dirty = 0;
+	stats.pinned += pinned;
+	return s;
+}
+
+// large transfers go to the driver in one piece (one multi block command, DMA
+// driven) and do not flush the cache. Cached sectors in the range are kept current
+static inline bool _Bypass(uint32_t count) {
+	return !nslots || count >= SC_BYPASS_SECTORS;
+}
+
+static block_dev_err_t _Read(sd_card_t *c, uint8_t *buf, uint64_t sector, uint32_t count) {
+	block_dev_err_t err;
+
+	if (_Bypass(count)) {
+		err = card_read(c, buf, sector, count);
+		if (err != SD_BLOCK_DEVICE_ERROR_NONE)
+			return err;
+		stats.card_read += count * SECTOR_SIZE;
+		stats.bypassed += count;
+		// what has not been written back yet is newer than the card
+		for (int i = 0; i < nslots; i++)
+			if (slots[i].dirty && slots[i].sector - sector < count)
+				memcpy(buf + (slots[i].sector - sector) * SECTOR_SIZE, _Data(i), SECTOR_SIZE);
+		return SD_BLOCK_DEVICE_ERROR_NONE;
+	}
+	uint32_t i = 0;
+	while (i < count) {
+		int s = _Lookup(sector + i);
+		if (s >= 0) {
+			stats.hits++;
+			slots[s].last_use = ++use_clock;
+			memcpy(buf + i * SECTOR_SIZE, _Data(s), SECTOR_SIZE);
+			i++;
+			continue;
+		}
+		// a run of misses is read in one go
+		uint32_t n = 1;
+		while (i + n < count && _Lookup(sector + i + n) < 0)
+			n++;
+		stats.misses += n;
+		err = card_read(c, buf + i * SECTOR_SIZE, sector + i, n);
+		if (err != SD_BLOCK_DEVICE_ERROR_NONE)
+			return err;
+		stats.card_read += n * SECTOR_SIZE;
+		for (uint32_t k = 0; k < n; k++) {
+			s = _Insert(sector + i + k, &err);
+			if (s < 0)
+				return err;
+			memcpy(_Data(s), buf + (i + k) * SECTOR_SIZE, SECTOR_SIZE);
+		}
+		i += n;
+	}
+	return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+static block_dev_err_t _Write(sd_card_t *c, const uint8_t *buf, uint64_t sector, uint32_t count) {
+	block_dev_err_t err;
+
+	if (sector < pin_end && sector + count > pin_start)
+		fat_writes++;
+
+	if (!write_back || _Bypass(count)) {
+		err = card_write(c, buf, sector, count);
+		if (err != SD_BLOCK_DEVICE_ERROR_NONE)
+			return err;
+		stats.card_written += count * SECTOR_SIZE;
+		if (count >= SC_BYPASS_SECTORS)
+			stats.bypassed += count;
+		// keep cached copies current (the card has the latest data now)
+		for (int i = 0; i < nslots; i++) {
+			if (slots[i].last_use && slots[i].sector - sector < count) {
+				memcpy(_Data(i), buf + (slots[i].sector - sector) * SECTOR_SIZE, SECTOR_SIZE);
+				if (slots[i].dirty) {
+					slots[i].dirty = 0;
+					stats.dirty--;
+				}
+			}
+		}
+		return SD_BLOCK_DEVICE_ERROR_NONE;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		int s = _Lookup(sector + i);
+		if (s < 0 && (s = _Insert(sector + i, &err)) < 0)
+			return err;
+		memcpy(_Data(s), buf + i * SECTOR_SIZE, SECTOR_SIZE);
+		slots[s].last_use = ++use_clock;
+		if (!slots[s].dirty) {
+			slots[s].dirty = 1;
+			stats.dirty++;
+		}
+	}
+	return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+static block_dev_err_t _Sync(sd_card_t *c) {
+	block_dev_err_t err = SC_Flush();
+	if (err != SD_BLOCK_DEVICE_ERROR_NONE)
+		return err;
+	return card_sync(c);
+}
+
+// dirty sectors go out in ascending order
+int SC_Flush() {
+	while (stats.dirty) {
+		int min = -1;
+		for (int i = 0; i < nslots; i++)
+			if (slots[i].dirty && (min < 0 || slots[i].sector < slots[min].sector))
+				min = i;
+		block_dev_err_t err = _WriteOut(min);
+		if (err != SD_BLOCK_DEVICE_ERROR_NONE)
+			return err;
+	}
+	return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+static void _Invalidate() {
+	for (int i = 0; i < nslots; i++)
+		slots[i].last_use = 0;
+	stats.pinned = stats.dirty = 0;
+}
+
+int SC_SetSize(int n) {
+	if (card && SC_Flush() != SD_BLOCK_DEVICE_ERROR_NONE)
+		return -1;
+	free(slots);
+	free(data);
+	slots = NULL;
+	data = NULL;
+	nslots = 0;
+	stats.pinned = stats.dirty = 0;
+	sized = true;
+
+	if (n > SC_MAX_SECTORS)
+		n = SC_MAX_SECTORS;
+	if (n <= 0)
+		return 0;
+	slots = calloc(n, sizeof(struct Slot));
+	data = malloc((uint32_t)n * SECTOR_SIZE);
+	if (!slots || !data) {
+		free(slots);
+		free(data);
+		slots = NULL;
+		data = NULL;
+		return -1;
+	}
+	nslots = n;
+	return 0;
+}
+
+void SC_Attach(sd_card_t *c, const FATFS *fs) {
+	if (c->read_blocks != _Read) {
+		card = c;
+		card_read = c->read_blocks;
+		card_write = c->write_blocks;
+		card_sync = c->sync;
+		c->read_blocks = _Read;
+		c->write_blocks = _Write;
+		c->sync = _Sync;
+	}
+	if (!sized)
+		SC_SetSize(SC_SECTORS);
+
+	// a (re)mounted volume: whatever is cached may be from another card, so
+	// sectors that are still dirty are dropped rather than written to this one
+	_Invalidate();
+	pin_start = fs->fatbase;
+	if (fs->fs_type == FS_FAT12 || fs->fs_type == FS_FAT16)
+		pin_end = fs->database;		// root directory follows the FATs
+	else
+		pin_end = fs->fatbase + (uint64_t)fs->fsize * fs->n_fats;
+}
+
+void SC_SetWriteBack(bool on) {
+	if (!on && card)
+		SC_Flush();
+	write_back = on;
+}
+
+bool SC_GetWriteBack() {
+	return write_back;
+}
+
+uint32_t SC_GetFatWrites() {
+	return fat_writes;
+}
+
+void SC_GetStats(struct SectorCacheStats *st) {
+	*st = stats;
+	st->sectors = nslots;
+}
+
+void SC_ClearStats() {
+	stats.hits = stats.misses = stats.evictions = stats.bypassed = 0;
+	stats.card_read = stats.card_written = 0;
+}
+
+// sdcache.c
@@ -0,0 +1,61 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * SECTOR CACHE
+ * sits between FatFS and the SD card driver by taking over the
+ * card's read_blocks/write_blocks/sync functions. Sectors are
+ * kept in LRU order; the FAT (and the FAT12/16 root directory)
+ * are preferred over file data, they get up to half of the slots.
+ *
+ * Writes go through to the card unless write-back is on: then
+ * they stay in the cache (dirty) until they get evicted, the
+ * card is synced (f_sync, f_close) or SC_Flush() is called.
+ * Mounting a volume again drops them (the card may have been
+ * swapped), so only a synced card is safe to take out.
+ * Transfers of SC_BYPASS_SECTORS or more (FatFS does those for
+ * sector aligned parts of large f_read/f_write calls) go to the
+ * driver as one multi block command instead
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ff.h"
+#include "sd_card.h"
+
+// default size in sectors (512 bytes each), can be changed at runtime
+#ifndef SC_SECTORS
+#define SC_SECTORS 16
+#endif
+#define SC_MAX_SECTORS 128
+
+// transfers of this many sectors or more bypass the cache
+#ifndef SC_BYPASS_SECTORS
+#define SC_BYPASS_SECTORS 8
+#endif
+
+struct SectorCacheStats {
+	uint32_t sectors;			// cache size
+	uint32_t pinned;			// slots holding FAT/directory sectors
+	uint32_t dirty;
+	uint32_t hits, misses, evictions;
+	uint32_t bypassed;			// sectors moved by transfers that bypassed the cache
+	uint64_t card_read;			// bytes transferred from and to the card
+	uint64_t card_written;
+};
+
+// take over the card's block functions (fs: the mounted volume, for the FAT region)
+void SC_Attach(sd_card_t *card, const FATFS *fs);
+
+int SC_SetSize(int sectors);	// 0 ok, -1 no memory (the cache is off then) or the flush failed
+void SC_SetWriteBack(bool on);
+bool SC_GetWriteBack();
+int SC_Flush();					// write dirty sectors: 0 or the driver's error
+
+// changes whenever FAT (or FAT12/16 root directory) sectors get written
+uint32_t SC_GetFatWrites();
+
+void SC_GetStats(struct SectorCacheStats *st);
+void SC_ClearStats();
+
+// sdcache.h
@@ -7,15 +7,26 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
 
 #include "pico/stdlib.h"
 
 #include "display.h"
 #include "conio.h"
+#include "shell.h"
+#include "platform.h"
+
+/* Number of elements in an array. */
+#define NELEMS(v) (sizeof(v) / sizeof(v[0]))
 
 // FatFS sd card support
 #include "sdcard.h"
+#include "dircache.h"
+#include "sdcache.h"
 #include "hw_config.h"
+#include "diskio.h"
 
 
 // *******************************************************************
@@ -74,6 +85,15 @@ sd_card_t *sd_get_by_num(size_t num) {
 
 static FATFS FS = { 0 };    // set fs_type = 0 (not mounted)
 
+// background free space count (see SD_Task())
+enum { SCAN_IDLE, SCAN_RUNNING, SCAN_ERROR };
+
+static uint8_t scan_state = SCAN_IDLE;
+static DWORD scan_next = 0;     // next FAT entry, 0: start a pass
+static DWORD scan_count;
+static uint32_t scan_fat_writes;
+static uint8_t *scan_buf = NULL;
+
 void SD_PrintError(FRESULT err) {
         Con_printf("card error: %s (%d)\n", FRESULT_str(err), err);
 }
@@ -85,10 +105,20 @@ static FRESULT _checkmount() {
         if (FR_OK != fr) {
             SD_PrintError(fr);
         }
+        else {
+            SC_Attach(&sd_card, &FS);
+            scan_state = SCAN_RUNNING;  // count the free space in the background
+            scan_next = 0;
+        }
+        DC_InvalidateAll();     // might be another card
     }
     return fr;
 }
 
+FRESULT SD_Mount() {
+    return _checkmount();
+}
+
 static DIR dir;
 static FILINFO fno;
 
@@ -96,17 +126,46 @@ FRESULT SD_ChangeDir (const char *path) {
     if(_checkmount() != FR_OK) 
         return -1;
     FRESULT fr = f_chdir (path);
+    if (fr == FR_OK)
+        DC_InvalidateRelative();
     return fr;
 }
 
+// the directory cache answers this unless the directory is too large for it
 FRESULT SD_ListDir (const char *path)
 {
     FRESULT res;
     int nfile, ndir;
+    const struct DirList *list;
 
     if(_checkmount() != FR_OK) 
         return -1;
 
+    res = DC_Open(path, &list);
+    if (res == FR_OK) {
+        nfile = ndir = 0;
+        for (int i = 0; i < list->count; i++) {
+            if (DC_IsDir(list, i)) {
+                printf("   <DIR>   %s\n", DC_Name(list, i));
+                Con_printf("   <DIR>   %s\n", DC_Name(list, i));
+                ndir++;
+            } else {
+                printf("%10ld ", (long)DC_Size(list, i));
+                Con_printf("%10ld ", (long)DC_Size(list, i));
+                printf("%s\n", DC_Name(list, i));
+                Con_printf("%s\n", DC_Name(list, i));
+                nfile++;
+            }
+        }
+        printf("%d dirs, %d files.\n", ndir, nfile);
+        Con_printf("%d dirs, %d files.\n", ndir, nfile);
+        return FR_OK;
+    }
+    if (res != FR_NOT_ENOUGH_CORE) {
+        Con_printf("Failed to open \"%s\". (%u)\n", path, res);
+        return res;
+    }
+
     memset(&dir,0,sizeof(DIR));
     memset(&fno,0,sizeof(FILINFO));
     
@@ -139,23 +198,275 @@ FRESULT SD_ListDir (const char *path)
     return res;
 }
 
-long SDCardTest() {
-    
-    if(_checkmount() != FR_OK) 
+// ----------------------------------------------------------------------------
+// FREE SPACE
+// f_getfree() may have to read the whole FAT. Instead the FAT gets counted a
+// few sectors at a time from the main loop after the mount. Once FS.free_clst
+// holds the count FatFS keeps it current as clusters get allocated and freed.
+// FAT writes (as seen by the sector cache) during a pass restart it
+// ----------------------------------------------------------------------------
+
+#define FREE_SCAN_SECTORS 8     // per SD_Task() call: one multi block read
+
+static inline bool _FreeKnown() {
+    return FS.free_clst <= FS.n_fatent - 2;
+}
+
+static void _ScanEnd(uint8_t state) {
+    free(scan_buf);
+    scan_buf = NULL;
+    scan_next = 0;
+    scan_state = state;
+}
+
+void SD_Task() {
+    if (scan_state != SCAN_RUNNING)
+        return;
+    if (FS.fs_type == 0 || _FreeKnown()) {     // unmounted, or the FSINFO sector had it
+        _ScanEnd(SCAN_IDLE);
+        return;
+    }
+
+    // FAT12 entries straddle sectors and exFAT keeps a bitmap: both are small
+    // enough for FatFS to count in one go
+    if (FS.fs_type == FS_FAT12 || FS.fs_type == FS_EXFAT) {
+        DWORD n;
+        FATFS *fsp;
+        _ScanEnd(f_getfree("sd", &n, &fsp) == FR_OK ? SCAN_IDLE : SCAN_ERROR);
+        return;
+    }
+
+    if (!scan_next) {
+        scan_buf = scan_buf ? scan_buf : malloc(FREE_SCAN_SECTORS * FS_SECTOR_SIZE);
+        if (!scan_buf) {
+            _ScanEnd(SCAN_ERROR);
+            return;
+        }
+        scan_next = 2;          // entries 0 and 1 are reserved
+        scan_count = 0;
+        scan_fat_writes = SC_GetFatWrites();
+    }
+
+    DWORD per_sector = FS.fs_type == FS_FAT32 ? FS_SECTOR_SIZE / 4 : FS_SECTOR_SIZE / 2;
+    DWORD first = scan_next / per_sector;
+    DWORD n = FS.fsize - first < FREE_SCAN_SECTORS ? FS.fsize - first : FREE_SCAN_SECTORS;
+    if (disk_read(FS.pdrv, scan_buf, FS.fatbase + first, n) != RES_OK) {
+        _ScanEnd(SCAN_ERROR);
+        return;
+    }
+
+    DWORD end = (first + n) * per_sector;
+    if (end > FS.n_fatent)
+        end = FS.n_fatent;
+    for (DWORD i = scan_next; i < end; i++) {
+        DWORD k = i - first * per_sector;
+        if (FS.fs_type == FS_FAT32) {
+            const uint8_t *e = scan_buf + k * 4;
+            if (!((e[0] | e[1] << 8 | e[2] << 16 | (DWORD)e[3] << 24) & 0x0FFFFFFF))
+                scan_count++;
+        }
+        else if (!(scan_buf[k * 2] | scan_buf[k * 2 + 1]))
+            scan_count++;
+    }
+    scan_next = end;
+
+    if (scan_next >= FS.n_fatent) {
+        if (SC_GetFatWrites() != scan_fat_writes) {
+            scan_next = 0;      // the FAT changed under the pass: count again
+            return;
+        }
+        FS.free_clst = scan_count;
+        FS.fsi_flag |= 1;       // FAT32: FSINFO gets the count with the next sync
+        _ScanEnd(SCAN_IDLE);
+    }
+}
+
+// 0: *mb is the free space, 1: still counting, -1: card error
+int SD_GetFree(uint32_t *mb) {
+    if (_checkmount() != FR_OK)
         return -1;
+    if (_FreeKnown()) {
+        *mb = ((uint64_t)FS.free_clst * FS.csize * FS_SECTOR_SIZE) >> 20;
+        return 0;
+    }
+    int ret = scan_state == SCAN_ERROR ? -1 : 1;
+    scan_state = SCAN_RUNNING;     // (another try after an error)
+    return ret;
+}
 
-    DWORD n_clusters;
-    FATFS *fsp;
-    FRESULT fr = f_getfree ("sd", &n_clusters, &fsp);
+static void _dir_cmd(struct cmd_arg *args, int nargs) {
+   	struct cmd_arg *arg0 = NULL;
+    FRESULT fr = FR_OK;
 
-    if (FR_OK != fr) {
-        panic("f_getfree error: %s (%d)\n", FRESULT_str(fr), fr);
+    if(nargs == 1) {
+   	    arg0 = &args[0];
+        fr = SD_ListDir (arg0->str);
+    } else {
+        fr = SD_ListDir ("");
     }
+    if(fr != FR_OK)
+        SD_PrintError(fr);
+}
+
+static void _cd_cmd(struct cmd_arg *args, int nargs) {
+   	struct cmd_arg *arg0 = &args[0];
+
+	printf("changing dir to:%s\n",arg0->str);
+    FRESULT fr = SD_ChangeDir(arg0->str);
+    if(fr != FR_OK)
+        SD_PrintError(fr);
+}
+
+static void _sdstat_cmd(struct cmd_arg *args, int nargs) {
+	struct SectorCacheStats st;
 
-    return n_clusters*FS.csize*FS_SECTOR_SIZE;
+	if (nargs == 1) {
+		const char *a = args[0].str;
+		if (!strcasecmp(a, "WB"))
+			SC_SetWriteBack(true);
+		else if (!strcasecmp(a, "WT"))
+			SC_SetWriteBack(false);
+		else if (!strcasecmp(a, "C"))
+			SC_ClearStats();
+		else {
+			char *end;
+			unsigned long n = strtoul(a, &end, 10);
+			while (isspace((unsigned char)*end))
+				end++;
+			if (end == a || *end || n > SC_MAX_SECTORS) {
+				Con_printf("Invalid size (0..%d sectors)\n", SC_MAX_SECTORS);
+				return;
+			}
+			if (SC_SetSize(n))
+				Con_printf("Not enough memory\n");
+		}
+	}
+	SC_GetStats(&st);
+	uint32_t lookups = st.hits + st.misses;
+	Con_printf("cache %lu sectors, %s, %lu pinned, %lu dirty\n", (unsigned long)st.sectors,
+		SC_GetWriteBack() ? "write-back" : "write-through", (unsigned long)st.pinned, (unsigned long)st.dirty);
+	Con_printf("%lu hits, %lu misses (%lu%%), %lu evictions\n", (unsigned long)st.hits, (unsigned long)st.misses,
+		lookups ? (unsigned long)((uint64_t)st.hits * 100 / lookups) : 0UL, (unsigned long)st.evictions);
+	Con_printf("card: %llu bytes read, %llu written\n", st.card_read, st.card_written);
+	Con_printf("%lu sectors bypassed the cache\n", (unsigned long)st.bypassed);
+	Con_printf("%d bytes free\n", P_GetFreeHeap());
+}
+
+// ----------------------------------------------------------------------------
+// SDBENCH: sequential and random throughput through FatFS (and the sector cache)
+// ----------------------------------------------------------------------------
+
+#define BENCH_FILE "sdbench.tmp"
+#define BENCH_RANDOM_OPS 200
+#define BENCH_MIN_KB 16				// one block of the largest size
+#define BENCH_MAX_KB (64 * 1024)
+
+static const UINT bench_sizes[] = { 512, 4096, 16384 };
+
+static uint32_t _KBps(uint32_t bytes, uint64_t us) {
+	return us ? (uint32_t)((uint64_t)bytes * 1000000 / 1024 / us) : 0;
+}
+
+static uint32_t _Iops(uint64_t us) {
+	return us ? (uint32_t)((uint64_t)BENCH_RANDOM_OPS * 1000000 / us) : 0;
+}
+
+// one pass over the file in bs sized requests. Returns the time in us, 0 on error
+static uint64_t _BenchSeq(FIL *f, uint8_t *buf, UINT bs, uint32_t total, bool write) {
+	UINT n;
+	FRESULT fr = f_lseek(f, 0);
+	uint64_t t = time_us_64();
+	for (uint32_t done = 0; fr == FR_OK && done < total; done += bs) {
+		fr = write ? f_write(f, buf, bs, &n) : f_read(f, buf, bs, &n);
+		if (n != bs)
+			fr = FR_DISK_ERR;
+	}
+	if (fr == FR_OK && write)
+		fr = f_sync(f);
+	t = time_us_64() - t;
+	return fr == FR_OK ? t : 0;
+}
+
+static uint64_t _BenchRandom(FIL *f, uint8_t *buf, UINT bs, uint32_t total, bool write) {
+	UINT n;
+	FRESULT fr = FR_OK;
+	uint32_t blocks = total / bs;
+	uint64_t t = time_us_64();
+	for (int i = 0; fr == FR_OK && i < BENCH_RANDOM_OPS; i++) {
+		fr = f_lseek(f, (FSIZE_t)(rand() % blocks) * bs);
+		if (fr == FR_OK)
+			fr = write ? f_write(f, buf, bs, &n) : f_read(f, buf, bs, &n);
+		if (fr == FR_OK && n != bs)
+			fr = FR_DISK_ERR;
+	}
+	if (fr == FR_OK && write)
+		fr = f_sync(f);
+	t = time_us_64() - t;
+	return fr == FR_OK ? t : 0;
+}
+
+static void _sdbench_cmd(struct cmd_arg *args, int nargs) {
+	static FIL f;
+	const UINT largest = bench_sizes[NELEMS(bench_sizes) - 1];
+	unsigned long kb = 1024;
+
+	if (nargs == 1) {
+		char *end;
+		kb = strtoul(args[0].str, &end, 10);
+		while (isspace((unsigned char)*end))	// the argument runs to the end of the line
+			end++;
+		if (end == args[0].str || *end || kb < BENCH_MIN_KB || kb > BENCH_MAX_KB) {
+			Con_printf("Invalid size (%d..%dKB)\n", BENCH_MIN_KB, BENCH_MAX_KB);
+			return;
+		}
+	}
+	// whole blocks of the largest size: no pass runs past the end of the file
+	uint32_t total = kb * 1024 / largest * largest;
+
+	if (_checkmount() != FR_OK)
+		return;
+	uint8_t *buf = malloc(largest);
+	if (!buf) {
+		Con_printf("Not enough memory\n");
+		return;
+	}
+	for (UINT i = 0; i < largest; i++)
+		buf[i] = i;
+
+	FRESULT fr = f_open(&f, BENCH_FILE, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	if (fr != FR_OK) {
+		SD_PrintError(fr);
+		free(buf);
+		return;
+	}
+	Con_printf("%luKB file, %d random ops\n", (unsigned long)(total / 1024), BENCH_RANDOM_OPS);
+	Con_printf("   bs  seq W  seq R rnd W rnd R\n");
+	Con_printf("       KB/s   KB/s  IOPS  IOPS\n");
+	for (int i = 0; i < NELEMS(bench_sizes); i++) {
+		UINT bs = bench_sizes[i];
+		uint64_t sw = _BenchSeq(&f, buf, bs, total, true);
+		uint64_t sr = _BenchSeq(&f, buf, bs, total, false);
+		uint64_t rw = _BenchRandom(&f, buf, bs, total, true);
+		uint64_t rr = _BenchRandom(&f, buf, bs, total, false);
+		if (!sw || !sr || !rw || !rr) {
+			Con_printf("card error\n");
+			break;
+		}
+		Con_printf("%5u %6lu %6lu %5lu %5lu\n", bs, (unsigned long)_KBps(total, sw), (unsigned long)_KBps(total, sr),
+			(unsigned long)_Iops(rw), (unsigned long)_Iops(rr));
+	}
+	f_close(&f);
+	f_unlink(BENCH_FILE);
+	DC_InvalidateFile(BENCH_FILE);
+	free(buf);
+}
 
-    // Unmount the SD card
-    //f_unmount("");
+// registers the sd card shell commands
+void SD_Open() {
+	ShellRegisterCommand("DIR", _dir_cmd, 0, 1, "DIR [path] - List current dir or [path]");
+	ShellRegisterCommand("CD", _cd_cmd, 1, 1, "CD path    - Change current directory");
+	ShellRegisterCommand("SDBENCH", _sdbench_cmd, 0, 1, "SDBENCH [KB] - Card throughput (1024KB file)");
+	ShellRegisterCommand("SDSTAT", _sdstat_cmd, 0, 1, "SDSTAT [n|WB|WT|C] - Sector cache: size, write mode, clear");
 }
 
 // sdcard.c
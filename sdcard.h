@@ -1,10 +1,15 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "f_util.h"
 #include "ff.h"
 
+void SD_Open();
+FRESULT SD_Mount();
 void SD_PrintError(FRESULT err);
-long SDCardTest();
+int SD_GetFree(uint32_t *mb);
+void SD_Task();			// main loop: background work (free space count)
 
 FRESULT SD_ListDir (const char *path);
 FRESULT SD_ChangeDir (const char *path);
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ff.h"
+#include "sdcard.h"
+#include "sdreader.h"
+
+// the buffer is used up: read the next chunk into it
+static bool _Fill(struct SDReader *r) {
+	r->len = r->pos = 0;
+	if (r->eof)
+		return false;
+	FRESULT fr = f_read(&r->f, r->buf, SR_BUFFER_SIZE, &r->len);
+	if (fr != FR_OK) {
+		r->err = fr;
+		r->len = 0;
+	}
+	if (r->len < SR_BUFFER_SIZE)
+		r->eof = true;
+	return r->len != 0;
+}
+
+static inline bool _Available(struct SDReader *r) {
+	return r->pos < r->len || _Fill(r);
+}
+
+// consume the next byte if it is c
+static inline bool _Skip(struct SDReader *r, uint8_t c) {
+	if (!_Available(r) || r->buf[r->pos] != c)
+		return false;
+	r->pos++;
+	return true;
+}
+
+FRESULT SR_Open(struct SDReader *r, const char *path) {
+	memset(r, 0, sizeof(*r));
+	FRESULT fr = SD_Mount();
+	if (fr != FR_OK)
+		return fr;
+	r->buf = malloc(SR_BUFFER_SIZE);
+	if (!r->buf)
+		return FR_NOT_ENOUGH_CORE;
+	fr = f_open(&r->f, path, FA_READ);
+	if (fr != FR_OK) {
+		SR_Close(r);
+		return fr;
+	}
+	_Fill(r);
+	return r->err;
+}
+
+void SR_Close(struct SDReader *r) {
+	if (r->f.obj.fs)
+		f_close(&r->f);
+	free(r->buf);
+	r->buf = NULL;
+}
+
+size_t SR_Read(struct SDReader *r, void *dst, size_t n) {
+	size_t done = 0;
+	if (r->cr && n) {
+		r->cr = false;
+		*(uint8_t *)dst = '\r';
+		done = 1;
+	}
+	while (done < n && _Available(r)) {
+		size_t k = r->len - r->pos;
+		if (k > n - done)
+			k = n - done;
+		memcpy((uint8_t *)dst + done, r->buf + r->pos, k);
+		r->pos += k;
+		done += k;
+	}
+	return done;
+}
+
+int SR_Gets(struct SDReader *r, char *line, int size) {
+	int n = 0;
+	bool any = false;
+	if (r->cr && size > 1) {
+		r->cr = false;
+		line[n++] = '\r';
+		any = true;
+	}
+	while (n < size - 1 && _Available(r)) {
+		const uint8_t *p = r->buf + r->pos;
+		const uint8_t *end = r->buf + r->len;
+		const uint8_t *nl = memchr(p, '\n', end - p);
+		size_t k = (nl ? nl : end) - p;
+		if (k > (size_t)(size - 1 - n))
+			k = size - 1 - n;
+		memcpy(line + n, p, k);
+		n += k;
+		r->pos += k;
+		any = true;
+		if (p + k == nl) {
+			r->pos++;		// the LF
+			if (n && line[n - 1] == '\r')
+				n--;
+			line[n] = 0;
+			return n;
+		}
+	}
+	// a line of exactly size - 1 characters: its line end belongs to it, not
+	// to an empty line after it
+	if (any && n == size - 1) {
+		if (_Skip(r, '\n')) {
+			if (line[n - 1] == '\r')
+				n--;			// the size limit fell between CR and LF
+		}
+		else if (_Available(r) && r->buf[r->pos] == '\r') {
+			if (r->pos + 1 < r->len) {
+				if (r->buf[r->pos + 1] == '\n')
+					r->pos += 2;
+			}
+			else {
+				r->pos++;		// the last byte of the chunk: kept back if no LF follows
+				r->cr = !_Skip(r, '\n');
+			}
+		}
+	}
+	line[n] = 0;
+	return any ? n : -1;
+}
+
+const char *SR_LuaReader(struct lua_State *L, void *ud, size_t *size) {
+	struct SDReader *r = ud;
+	if (r->cr) {
+		r->cr = false;
+		*size = 1;
+		return "\r";
+	}
+	if (!_Available(r)) {
+		*size = 0;
+		return NULL;
+	}
+	const char *p = (const char *)r->buf + r->pos;
+	*size = r->len - r->pos;
+	r->pos = r->len;
+	return p;
+}
+
+// sdreader.c
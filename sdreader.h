@@ -0,0 +1,49 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * STREAMING FILE READER
+ * reads a file in large sector aligned chunks (one multi block
+ * transfer each, past the sector cache) into one buffer, so
+ * parsing costs one card round trip per chunk instead of one per
+ * sector. The card driver has no background transfers: a chunk
+ * gets read when the previous one is used up.
+ * Line, block and lua_Reader front ends
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ff.h"
+
+// a multiple of the sector size
+#ifndef SR_BUFFER_SIZE
+#define SR_BUFFER_SIZE 8192
+#endif
+
+struct SDReader {
+	FIL f;
+	uint8_t *buf;
+	UINT len;					// bytes in the buffer
+	UINT pos;					// next byte in it
+	bool eof;					// the file has been read to the end
+	bool cr;					// a CR taken off the end of the buffer that did not end a line:
+								// it is the next byte to deliver
+	FRESULT err;				// first read error
+};
+
+FRESULT SR_Open(struct SDReader *r, const char *path);
+void SR_Close(struct SDReader *r);
+
+// up to n bytes, 0 at the end of the file
+size_t SR_Read(struct SDReader *r, void *dst, size_t n);
+
+// the next line without its line end (LF or CR LF) and at most size - 1
+// characters of it (the rest comes with the next call). -1 at the end of the file
+int SR_Gets(struct SDReader *r, char *line, int size);
+
+// lua_Reader for lua_load(): ud is the reader
+struct lua_State;
+const char *SR_LuaReader(struct lua_State *L, void *ud, size_t *size);
+
+// sdreader.h
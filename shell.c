@@ -1,16 +1,21 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #include "display.h"
 #include "conio.h"
 #include "sdcard.h"
 #include "platform.h"
-#include "ed.h"
+#include "scrollback.h"
+#include "input.h"
+#include "latency.h"
+#include "shell.h"
+#include "dircache.h"
 
 #define CMD_LINE_MAX_CHARS 128
-#define CMD_MAX_CHARS  16
 
 /* Number of elements in an array. */
 #define NELEMS(v) (sizeof(v) / sizeof(v[0]))
@@ -23,99 +28,194 @@ static unsigned char line_edit_mode = 0;
 
 
 // shell commands
-struct cmd_arg {
-	const char *str;
-	size_t len;
-};
-
-typedef void (*cmd_f)(struct cmd_arg *, int);
-
 struct command {
-	const char *name;
+	char name[SHELL_CMD_MAX_CHARS + 1];		// empty: free slot
+	uint32_t hash;
 	cmd_f fun;
+	const char *help;
 	unsigned char nargs;
 	unsigned char nextra_args;
 };
 
-static struct cmd_arg args[2];
-static char name[CMD_MAX_CHARS + 1];
-
+// open addressing (linear probing) on the name hash
+static struct command s_commands[SHELL_CMD_SLOTS];
+static uint8_t s_order[SHELL_CMD_SLOTS];		// slots in registration order (for HELP)
+static int s_ncommands = 0;
 
-static const char *s_help[] = {
-"INFO       - Display system information",
-"ED [file]  - Edit [file]",
-"RUN [file] - Compile and run [file]",
-"COMPILE    - Compile program",
-"DIR [path] - List current dir or [path]",
-"CD path    - Change current directory",
-};
+static struct cmd_arg args[SHELL_MAX_ARGS];
+static char name[SHELL_CMD_MAX_CHARS + 1];
 
 /******************************************************************************
  * COMMANDS
  */
 static void _help_cmd(struct cmd_arg *args, int nargs) {
-	int i;
-	for (i = 0; i < NELEMS(s_help); i++) {
-		Con_printf("%s\n", s_help[i]);
+	for (int i = 0; i < s_ncommands; i++) {
+		Con_printf("%s\n", s_commands[s_order[i]].help);
 	}
 }
 
 static void _info_cmd(struct cmd_arg *args, int nargs) {
 	Con_printf("Picolo System v%s\n%d bytes free \n", PLATFORM_VERSION_STRING, P_GetFreeHeap());
-	Con_printf("%ldMB free sd card storage\n", SDCardTest()/(1024*1024));
+	uint32_t free_mb;
+	switch (SD_GetFree(&free_mb)) {
+	case 0:  Con_printf("%luMB free sd card storage\n", (unsigned long)free_mb); break;
+	case 1:  Con_printf("sd card: counting free space\n"); break;
+	default: Con_printf("sd card: free space unknown\n"); break;
+	}
+	unsigned high_water, dropped;
+	ConGetInputStats(ConGetCurrent(), &high_water, &dropped);
+	Con_printf("input: %u max pending, %u dropped\n", high_water, dropped);
+	InputGetStats(&high_water, &dropped);
+	Con_printf("events: %u max pending, %u dropped\n", high_water, dropped);
+	uint32_t hits, misses, bytes;
+	DC_GetStats(&hits, &misses, &bytes);
+	Con_printf("dir cache: %lu bytes, %lu hits, %lu misses\n", (unsigned long)bytes, (unsigned long)hits, (unsigned long)misses);
 }
 
-static void _dir_cmd(struct cmd_arg *args, int nargs) {
-   	struct cmd_arg *arg0 = NULL;
-    FRESULT fr = FR_OK;
-
-    if(nargs == 1) {
-   	    arg0 = &args[0];
-        fr = SD_ListDir (arg0->str);
-    } else {
-        fr = SD_ListDir ("");
-    }
-    if(fr != FR_OK)
-        SD_PrintError(fr);
+static void _mode_cmd(struct cmd_arg *args, int nargs) {
+	if (nargs == 1) {
+		int mode = atoi(args[0].str);
+		const struct DisplayMode *old = D_MODE;
+		if (mode < 0 || mode >= D_MODE_COUNT) {
+			Con_printf("Invalid mode\n");
+			return;
+		}
+		int err = DisplaySetMode(mode);
+		if (old->cols != D_MODE->cols || old->rows != D_MODE->rows)
+			ConSetCursorPos(0, 0);	// the screen got cleared
+		if (err) {
+			Con_printf("Not enough memory\n");
+			return;
+		}
+	}
+	else {
+		// list all modes with their framebuffer memory budget
+		for (int i = 0; i < D_MODE_COUNT; i++)
+			Con_printf("%d %-12s %3dx%d %6lu\n", i, DISPLAY_MODES[i].name,
+				DISPLAY_MODES[i].width, DISPLAY_MODES[i].height, (unsigned long)DISPLAY_MODES[i].fb_size);
+	}
+	int mode = DisplayGetMode();
+	Con_printf("Mode %d (%s), %d bytes free\n", mode, DISPLAY_MODES[mode].name, P_GetFreeHeap());
 }
 
-static void _cd_cmd(struct cmd_arg *args, int nargs) {
-   	struct cmd_arg *arg0 = &args[0];
-
-	printf("changing dir to:%s\n",arg0->str);
-    FRESULT fr = SD_ChangeDir(arg0->str);
-    if(fr != FR_OK)
-        SD_PrintError(fr);
+static void _repeat_cmd(struct cmd_arg *args, int nargs) {
+	uint32_t delay, rate;
+	if (nargs == 2) {
+		int d = atoi(args[0].str);
+		int r = atoi(args[1].str);
+		if (d < 0 || r < 0) {
+			Con_printf("Invalid value\n");
+			return;
+		}
+		InputSetRepeat(d, r);
+	}
+	else if (nargs == 1) {
+		Con_printf("Usage: REPEAT delay rate\n");
+		return;
+	}
+	InputGetRepeat(&delay, &rate);
+	if (rate)
+		Con_printf("key repeat after %lums, every %lums\n", (unsigned long)delay, (unsigned long)rate);
+	else
+		Con_printf("key repeat off\n");
 }
 
-static void _ed_cmd(struct cmd_arg *args, int nargs) {
-	e_Edit(NULL);
-}
+static void _latency_cmd(struct cmd_arg *args, int nargs) {
+	static const char *stages[LAT_STAGE_COUNT] = { "input", "scanout", "total" };
 
-static const struct command s_commands[] = {
-	{ "INFO", _info_cmd, 0, 1 },
-	{ "HELP", _help_cmd, 0, 1 },
-	{ "DIR",  _dir_cmd, 0, 1 },
-	{ "CD",   _cd_cmd, 1, 1 },
-	{ "ED",   _ed_cmd, 0, 1 },
-};
+	if (nargs == 1 && toupper((unsigned char)args[0].str[0]) == 'C') {
+		InputClearLatency();
+		LAT_Clear();
+		return;
+	}
+	uint32_t hist[INPUT_LATENCY_BUCKETS], max_us;
+	uint32_t count = 0;
+	InputGetLatency(hist, &max_us);
+	Con_printf("report to console read:\n");
+	for (int b = 0; b < INPUT_LATENCY_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		count += hist[b];
+		if (b == INPUT_LATENCY_BUCKETS - 1)
+			Con_printf(" >=%6luus %lu\n", 1UL << b, (unsigned long)hist[b]);
+		else
+			Con_printf("  <%6luus %lu\n", 2UL << b, (unsigned long)hist[b]);
+	}
+	Con_printf("%lu keys, max %luus\n", (unsigned long)count, (unsigned long)max_us);
+
+	// keypress to photon, per stage
+	Con_printf("stage     min   avg   p99   max\n");
+	for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+		struct LatencyStats st;
+		LAT_GetStats(i, &st);
+		Con_printf("%-7s %5lu %5lu %5lu %5lu\n", stages[i], (unsigned long)st.min,
+			(unsigned long)st.avg, (unsigned long)st.p99, (unsigned long)st.max);
+	}
+}
 
 /******************************************************************************
  * COMMAND PARSER
  */
 
+// FNV-1a
+static uint32_t _hash(const char *str) {
+	uint32_t h = 2166136261u;
+	while (*str)
+		h = (h ^ (unsigned char)*str++) * 16777619u;
+	return h;
+}
+
+/* Finds the slot of a command (upper case name) or the free slot it would go into */
+static int _find_slot(const char *str, uint32_t hash) {
+	int i = hash & (SHELL_CMD_SLOTS - 1);
+	while (s_commands[i].name[0]) {
+		if (s_commands[i].hash == hash && strcmp(str, s_commands[i].name) == 0)
+			break;
+		i = (i + 1) & (SHELL_CMD_SLOTS - 1);
+	}
+	return i;
+}
+
 /* Finds a command and returns the command index or -1 */
 static int find_cmd(const char *str)
 {
-	int i;
+	int i = _find_slot(str, _hash(str));
+	return s_commands[i].name[0] ? i : -1;
+}
 
-	for (i = 0; i < NELEMS(s_commands); i++)
-		if (strcmp(str, s_commands[i].name) == 0)
-			return i;
+int ShellRegisterCommand(const char *cmd, cmd_f fun, int nargs, int nextra_args, const char *help) {
+	char upper[SHELL_CMD_MAX_CHARS + 1];
+	size_t len = strlen(cmd);
 
-	return -1;
+	if (!len || len > SHELL_CMD_MAX_CHARS || nargs < 0 || nextra_args < 0 || nargs + nextra_args > SHELL_MAX_ARGS)
+		return -1;
+	for (size_t j = 0; j <= len; j++)
+		upper[j] = toupper((unsigned char)cmd[j]);
+
+	uint32_t hash = _hash(upper);
+	int i = _find_slot(upper, hash);
+	if (!s_commands[i].name[0]) {
+		// keep the load low so probe runs stay short
+		if (s_ncommands >= SHELL_CMD_SLOTS * 3 / 4)
+			return -1;
+		memcpy(s_commands[i].name, upper, len + 1);
+		s_commands[i].hash = hash;
+		s_order[s_ncommands++] = i;
+	}
+	s_commands[i].fun = fun;
+	s_commands[i].help = help;
+	s_commands[i].nargs = nargs;
+	s_commands[i].nextra_args = nextra_args;
+	return 0;
 }
 
+void ShellOpen() {
+	ShellRegisterCommand("HELP", _help_cmd, 0, 1, "HELP       - List commands");
+	ShellRegisterCommand("INFO", _info_cmd, 0, 1, "INFO       - Display system information");
+	ShellRegisterCommand("MODE", _mode_cmd, 0, 1, "MODE [n]   - List modes or set display mode");
+	ShellRegisterCommand("REPEAT", _repeat_cmd, 0, 2, "REPEAT [delay rate] - Show or set key repeat (ms)");
+	ShellRegisterCommand("LATENCY", _latency_cmd, 0, 1, "LATENCY [C] - Keypress to screen latency, C clears it");
+}
 
 static void _parse_token(const char *str, size_t *start, size_t *tok_len, size_t *parse_len) {
 
@@ -190,7 +290,7 @@ void ShellProcessLine(char *lp) {
 	size_t start, tok_len, parse_len, collected;
 
 	_parse_token(lp, &start, &tok_len, &parse_len);
-	copy_to_str(name, lp + start, min_size(tok_len, (size_t) CMD_MAX_CHARS));
+	copy_to_str(name, lp + start, min_size(tok_len, (size_t) SHELL_CMD_MAX_CHARS));
 	//toupper_str(name);
     strupr(name);
 
@@ -210,6 +310,286 @@ void ShellProcessLine(char *lp) {
 	s_commands[i].fun(args, collected); 
 }
 
+/******************************************************************************
+ * HISTORY
+ * entered lines packed into one byte arena as [len] text [len], oldest first:
+ * the length at both ends lets recall walk either way. The offsets run freely
+ * (masked on access) and the oldest lines make room for new ones
+ */
+
+#define HIST_MASK (SHELL_HISTORY_BYTES - 1)
+#define HIST_AT(o) hist[(o) & HIST_MASK]
+
+static char hist[SHELL_HISTORY_BYTES];
+static uint32_t hist_head = 0;		// end of the newest line
+static uint32_t hist_tail = 0;		// start of the oldest line
+static uint32_t hist_pos = 0;		// start of the line recalled, hist_head: the line being typed
+static char hist_stash[CMD_LINE_MAX_CHARS + 1];	// the line being typed while recalling
+
+static inline int _HistLen(uint32_t s) {
+	return (uint8_t)HIST_AT(s);
+}
+
+static inline uint32_t _HistOlder(uint32_t s) {
+	return s - (uint8_t)HIST_AT(s - 1) - 2;
+}
+
+static inline uint32_t _HistNewer(uint32_t s) {
+	return s + _HistLen(s) + 2;
+}
+
+static void _HistCopy(uint32_t s, char *dst) {
+	int len = _HistLen(s);
+	for (int i = 0; i < len; i++)
+		dst[i] = HIST_AT(s + 1 + i);
+	dst[len] = 0;
+}
+
+static void _HistoryAdd(const char *text) {
+	size_t len = strlen(text);		// at most CMD_LINE_MAX_CHARS: fits the length byte
+	if (!len)
+		return;
+
+	// the same command again only gets stored once
+	if (hist_head != hist_tail) {
+		uint32_t s = _HistOlder(hist_head);
+		size_t i = 0;
+		if (_HistLen(s) == len)
+			while (i < len && HIST_AT(s + 1 + i) == text[i])
+				i++;
+		if (i == len)
+			return;
+	}
+
+	while (SHELL_HISTORY_BYTES - (hist_head - hist_tail) < len + 2)
+		hist_tail = _HistNewer(hist_tail);
+	HIST_AT(hist_head) = len;
+	for (size_t i = 0; i < len; i++)
+		HIST_AT(hist_head + 1 + i) = text[i];
+	HIST_AT(hist_head + len + 1) = len;
+	hist_head += len + 2;
+}
+
+// the newest line at or before s (hist_head: from the newest on) containing q, hist_head if none does
+static uint32_t _HistFind(uint32_t s, const char *q) {
+	char text[CMD_LINE_MAX_CHARS + 1];
+
+	if (hist_head == hist_tail)
+		return hist_head;
+	if (s == hist_head)
+		s = _HistOlder(s);
+	for (;;) {
+		_HistCopy(s, text);
+		if (strstr(text, q))
+			return s;
+		if (s == hist_tail)
+			return hist_head;
+		s = _HistOlder(s);
+	}
+}
+
+// show text in place of old, which the cursor is at offset at of: only the cells
+// from the first difference on get written. That goes through the console, so a
+// line longer than a row wraps (and scrolls) like a typed one. The cursor ends up
+// at offset cursor of text
+static void _RedrawLine(const char *old, const char *text, int at, int cursor) {
+	int row, col;
+	int o = strlen(old);
+	int n = strlen(text);
+	int p = 0;
+
+	ConGetCursorPos(&row, &col);
+	int start = row * D_CHAR_COLS + col - at;		// cell of the first character
+	while (p < n && p < o && old[p] == text[p])
+		p++;
+	if (start + p < 0)
+		p = -start;				// the beginning scrolled off the top
+	int end = n > o ? n : o;
+	if (p < end) {
+		ConSetCursorPos((start + p) / D_CHAR_COLS, (start + p) % D_CHAR_COLS);
+		if (p < n)
+			Con_fputs(text + p, stdout);
+		if (o > n)
+			Con_printf("%*s", o - (p > n ? p : n), "");
+		at = end;
+		ConGetCursorPos(&row, &col);
+	}
+	// counted back from where the cursor is: writing may have scrolled
+	int cell = row * D_CHAR_COLS + col - (at - cursor);
+	if (cell < 0)
+		cell = 0;
+	ConSetCursorPos(cell / D_CHAR_COLS, cell % D_CHAR_COLS);
+}
+
+// make text the line being edited, with the cursor at its end (at: the cursor offset in old)
+static void _SetLine(const char *old, const char *text, int at) {
+	char copy[CMD_LINE_MAX_CHARS + 1];
+
+	strcpy(copy, text);		// text may be editor_line itself
+	_RedrawLine(old, copy, at, strlen(copy));
+	strcpy(editor_line, copy);
+	line_write_index = strlen(copy);
+}
+
+static void _Recall(uint32_t pos) {
+	char text[CMD_LINE_MAX_CHARS + 1];
+
+	if (pos == hist_head)
+		strcpy(text, hist_stash);
+	else
+		_HistCopy(pos, text);
+	_SetLine(editor_line, text, line_write_index);
+	hist_pos = pos;
+}
+
+static void _HistoryUp() {
+	if (hist_pos == hist_tail)
+		return;
+	if (hist_pos == hist_head)
+		strcpy(hist_stash, editor_line);
+	_Recall(_HistOlder(hist_pos));
+}
+
+static void _HistoryDown() {
+	if (hist_pos != hist_head)
+		_Recall(_HistNewer(hist_pos));
+}
+
+// incremental reverse search (ctrl-r): the input line shows the query and the
+// newest line containing it. Echo is off while it runs
+#define SEARCH_PREFIX "search `"
+#define SEARCH_MAX_CHARS 32
+
+static unsigned char searching = 0;
+static char search_query[SEARCH_MAX_CHARS + 1];
+static int search_len;
+static uint32_t search_match;		// start of the line found, hist_head if none
+static char search_row[CMD_LINE_MAX_CHARS + SEARCH_MAX_CHARS + 16];	// what the input line shows
+static int search_cursor;			// cursor offset in search_row
+
+static void _SearchShow() {
+	char text[CMD_LINE_MAX_CHARS + 1];
+	char row[sizeof(search_row)];
+
+	text[0] = 0;
+	if (search_match != hist_head)
+		_HistCopy(search_match, text);
+	snprintf(row, sizeof(row), SEARCH_PREFIX "%s': %s", search_query, text);
+	_RedrawLine(search_row, row, search_cursor, strlen(SEARCH_PREFIX) + search_len);
+	strcpy(search_row, row);
+	search_cursor = strlen(SEARCH_PREFIX) + search_len;
+}
+
+static void _SearchStart() {
+	ConEchoOff();
+	searching = 1;
+	search_len = 0;
+	search_query[0] = 0;
+	search_match = hist_head;
+	strcpy(search_row, editor_line);
+	search_cursor = line_write_index;
+	_SearchShow();
+}
+
+// leave the search with text as the line being edited
+static void _SearchEnd(const char *text) {
+	_SetLine(search_row, text, search_cursor);
+	searching = 0;
+	hist_pos = hist_head;
+	ConEchoOn();
+}
+
+// returns 1 if the line found is to be run
+static unsigned char _SearchKey(int c) {
+	char text[CMD_LINE_MAX_CHARS + 1];
+	uint32_t s;
+
+	switch (c) {
+	case 0:
+		return 0;
+	case M16_CON_CTRL_R:	// next older match
+		if (search_len && search_match != hist_head && search_match != hist_tail) {
+			s = _HistFind(_HistOlder(search_match), search_query);
+			if (s != hist_head) {
+				search_match = s;
+				_SearchShow();
+			}
+		}
+		return 0;
+	case 8:
+		if (search_len) {
+			search_query[--search_len] = 0;
+			search_match = search_len ? _HistFind(hist_head, search_query) : hist_head;
+			_SearchShow();
+		}
+		return 0;
+	case 27:				// ESC: back to the line as it was
+		_SearchEnd(editor_line);
+		return 0;
+	}
+
+	if (c >= 32 && c <= 126) {
+		// keys that do not match anything are ignored
+		if (search_len < SEARCH_MAX_CHARS) {
+			search_query[search_len] = c;
+			search_query[search_len + 1] = 0;
+			s = _HistFind(search_match, search_query);
+			if (s != hist_head) {
+				search_len++;
+				search_match = s;
+				_SearchShow();
+			}
+			else
+				search_query[search_len] = 0;
+		}
+		return 0;
+	}
+
+	// anything else takes the line found: enter runs it, the others leave it for editing
+	if (search_match != hist_head) {
+		_HistCopy(search_match, text);
+		_SearchEnd(text);
+	}
+	else
+		_SearchEnd(editor_line);
+	if (c == 10) {
+		Con_printf("\n");
+		return editor_line[0] != 0;
+	}
+	return 0;
+}
+
+/******************************************************************************
+ * PATH COMPLETION
+ * TAB completes the word before the cursor (at the end of the line) from the
+ * directory cache. If there is nothing to add the candidates get listed
+ */
+static void _Complete() {
+	char add[CMD_LINE_MAX_CHARS + 1];
+	char text[CMD_LINE_MAX_CHARS + 1];
+	struct DirMatch m;
+
+	int len = strlen(editor_line);
+	if (line_write_index != len)
+		return;
+	int start = len;
+	while (start > 0 && editor_line[start - 1] != ' ' && editor_line[start - 1] != '"')
+		start--;
+
+	int n = DC_Complete(editor_line + start, add, CMD_LINE_MAX_CHARS + 1 - len, &m);
+	if (n) {
+		strcpy(text, editor_line);
+		strcpy(text + len, add);
+		_SetLine(editor_line, text, line_write_index);
+	}
+	else if (m.count > 1) {
+		Con_printf("\n");
+		for (int i = 0; i < m.count; i++)
+			Con_printf("%s%s  ", DC_Name(m.list, m.first + i), DC_IsDir(m.list, m.first + i) ? "/" : "");
+		Con_printf("\n%s", editor_line);
+	}
+}
+
 /******************************************************************************
  * INPUT HANDLING
  */
@@ -232,18 +612,62 @@ char *ShellReadInput() {
 		line_write_index = 0;
 		b_dirty = 0;
         line = NULL;
+		hist_pos = hist_head;
+
+		// the command that just ran may have kept the input from being read
+		unsigned lost = InputTakeLost();
+		if (lost)
+			Con_printf("warning: %u keys lost\n", lost);
     }
 
 	c = Con_getc_nb(stdin);
     //putchar(c);
 
+	if (searching) {
+		if (_SearchKey(c)) {
+			_HistoryAdd(editor_line);
+			line = editor_line;
+		}
+		else if (!searching && editor_line[0])
+			b_dirty = 1;
+		return line;
+	}
+
+	// any other key ends a scrollback view before it gets processed
+	if (c && c != M16_CON_PGUP && c != M16_CON_PGDOWN)
+		SB_ViewExit();
+
 	switch (c) {
+	case M16_CON_PGUP:
+		SB_PageUp();
+		break;
+	case M16_CON_PGDOWN:
+		SB_PageDown();
+		break;
 	case M16_CON_CURSOR_LEFT:
 		if (line_write_index > 0) {
 			line_write_index--;
 			ConCursorLeft();
 		} 
 		break;
+	case M16_CON_CURSOR_UP:
+		_HistoryUp();
+		if (editor_line[0])
+			b_dirty = 1;
+		break;
+	case M16_CON_CURSOR_DOWN:
+		_HistoryDown();
+		if (editor_line[0])
+			b_dirty = 1;
+		break;
+	case M16_CON_CTRL_R:
+		_SearchStart();
+		break;
+	case 9:		// TAB
+		_Complete();
+		if (editor_line[0])
+			b_dirty = 1;
+		break;
 	case M16_CON_CURSOR_RIGHT:
 		if (line_write_index < CMD_LINE_MAX_CHARS - 1 && line_write_index < strlen(editor_line)) {
 			// standard cursor right while editing
@@ -257,6 +681,7 @@ char *ShellReadInput() {
 		break;
 	case 10:	// new line
 		if (b_dirty) {
+			_HistoryAdd(editor_line);
             line = editor_line;
 		}
 		break;
@@ -1,6 +1,39 @@
+#pragma once
 
+#include <stddef.h>
+
+// shell commands
+#define SHELL_CMD_MAX_CHARS 16		// command name length
+#define SHELL_MAX_ARGS 4
+
+// command table slots: a power of two, at most 3/4 of them get used
+#define SHELL_CMD_SLOTS 64
+
+// command history arena: a power of two
+#ifndef SHELL_HISTORY_BYTES
+#define SHELL_HISTORY_BYTES 1024
+#endif
+
+#if SHELL_HISTORY_BYTES & (SHELL_HISTORY_BYTES - 1)
+#error SHELL_HISTORY_BYTES must be a power of two
+#endif
+
+struct cmd_arg {
+	const char *str;
+	size_t len;
+};
+
+typedef void (*cmd_f)(struct cmd_arg *, int);
+
+// registers the built-in commands
+void ShellOpen();
+
+// name is looked up case insensitive, help is the line HELP shows for it (not copied).
+// Registering a name again replaces the command. Returns 0, or -1 if the table is full
+// or the name/argument counts do not fit
+int ShellRegisterCommand(const char *name, cmd_f fun, int nargs, int nextra_args, const char *help);
 
 char *ShellReadInput();
 void ShellProcessLine(char *lp);
 
-// shell.h
\ No newline at end of file
+// shell.h
@@ -0,0 +1,306 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "conio.h"
+#include "cformat.h"
+#include "uartcon.h"
+#include "shell.h"
+
+#define UC_UART uart1
+
+#define TX_SIZE (1u << UC_TX_RING_BITS)
+#define TX_MASK (TX_SIZE - 1)
+#define RX_SIZE (1u << UC_RX_RING_BITS)
+#define RX_MASK (RX_SIZE - 1)
+
+// the DMA ring wrap needs the buffers aligned to their size
+static uint8_t tx_ring[TX_SIZE] __attribute__((aligned(TX_SIZE)));
+static uint8_t rx_ring[RX_SIZE] __attribute__((aligned(RX_SIZE)));
+
+static bool uc_open = false;
+static int mode = UC_MODE_OFF;
+static int tx_chan, rx_chan;
+
+static uint32_t tx_head = 0;				// free running: written by the main loop
+static volatile uint32_t tx_tail = 0;		// free running: advanced by the DMA interrupt
+static volatile uint32_t tx_inflight = 0;	// bytes the running transfer sends, 0 if idle
+static uint32_t rx_base = 0;				// free running count of the RX transfer's first byte
+static uint32_t rx_tail = 0;				// free running: next byte to read
+
+static uint32_t tx_bytes = 0, tx_dropped = 0, rx_bytes = 0, rx_lost = 0;
+
+// ----------------------------------------------------------------------------
+// TX
+// ----------------------------------------------------------------------------
+
+// start sending what is pending (interrupts disabled or from the DMA interrupt)
+static void _TxKick() {
+	if (tx_inflight)
+		return;
+	uint32_t n = tx_head - tx_tail;
+	if (!n)
+		return;
+	tx_inflight = n;
+	dma_channel_set_read_addr(tx_chan, &tx_ring[tx_tail & TX_MASK], false);
+	dma_channel_set_trans_count(tx_chan, n, true);		// the read side wraps around the ring
+}
+
+static void _TxDone() {
+	if (!(dma_hw->ints1 & (1u << tx_chan)))
+		return;
+	dma_hw->ints1 = 1u << tx_chan;
+	tx_tail += tx_inflight;
+	tx_inflight = 0;
+	_TxKick();
+}
+
+// copy into the ring: whatever does not fit is dropped (and counted)
+static void _Put(const char *p, int n) {
+	uint32_t head = tx_head;
+	uint32_t room = TX_SIZE - (head - tx_tail);
+	for (int i = 0; i < n; i++) {
+		if (!room) {
+			tx_dropped += n - i;
+			break;
+		}
+		tx_ring[head++ & TX_MASK] = p[i];
+		room--;
+	}
+	tx_bytes += head - tx_head;
+	__dmb();
+	tx_head = head;
+}
+
+static void _Send() {
+	uint32_t save = save_and_disable_interrupts();
+	_TxKick();
+	restore_interrupts(save);
+}
+
+// console output: LF goes out as CR LF and BS erases like it does on screen
+// one DMA kick per call
+void UC_Write(const char *p, int n) {
+	if (mode == UC_MODE_OFF)
+		return;
+	const char *run = p;
+	const char *end = p + n;
+	for (; p < end; p++) {
+		if (*p == '\n' || *p == '\b') {
+			_Put(run, p - run);
+			if (*p == '\n')
+				_Put("\r\n", 2);
+			else
+				_Put("\b \b", 3);
+			run = p + 1;
+		}
+	}
+	_Put(run, end - run);
+	_Send();
+}
+
+// ANSI encoding of what the console does without writing characters
+static void _Ansi(const char *format, ...) {
+	if (mode != UC_MODE_ANSI)
+		return;
+	char buf[16];
+	va_list ap;
+	va_start(ap, format);
+	int n = CF_vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	_Put(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+	_Send();
+}
+
+void UC_CursorTo(int row, int col) {
+	_Ansi("\x1b[%d;%dH", row + 1, col + 1);
+}
+
+// palette indices to ANSI colour numbers (the bright half adds 60)
+static const uint8_t ansi_colors[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+void UC_Color(int fg, int bg) {
+	_Ansi("\x1b[%d;%dm", (fg & 8 ? 90 : 30) + ansi_colors[fg & 7], (bg & 8 ? 100 : 40) + ansi_colors[bg & 7]);
+}
+
+void UC_ClearRow() {
+	_Ansi("\r\x1b[2K");
+}
+
+void UC_ClearScreen() {
+	_Ansi("\x1b[2J\x1b[H");
+}
+
+// ----------------------------------------------------------------------------
+// RX
+// ----------------------------------------------------------------------------
+
+// a lone ESC: nothing that starts a sequence followed within this time
+#define ESC_TIMEOUT_US 20000
+
+// host terminal input: ESC [ / ESC O sequences for the cursor and paging keys,
+// the ctrl keys the keyboard path knows, DEL as backspace
+static int rx_state = 0;		// 0 normal, 1 ESC seen, 2 in a sequence
+static int rx_param = 0;
+static bool rx_cr = false;		// last character was a CR (CR LF counts once)
+static uint32_t rx_esc_us;		// when the ESC came in
+
+static void _Receive(int c) {
+	if (rx_state == 1) {
+		if (c == '[' || c == 'O') {
+			rx_state = 2;
+			rx_param = 0;
+			return;
+		}
+		rx_state = 0;
+		ConStoreCharacter(27);	// just the ESC key, c is input of its own
+	}
+	if (rx_state == 2) {
+		if (c >= '0' && c <= '9') {
+			rx_param = rx_param * 10 + c - '0';
+			return;
+		}
+		if (c == ';')
+			return;
+		rx_state = 0;
+		switch (c) {
+		case 'A': ConStoreCharacter(M16_CON_CURSOR_UP); break;
+		case 'B': ConStoreCharacter(M16_CON_CURSOR_DOWN); break;
+		case 'C': ConStoreCharacter(M16_CON_CURSOR_RIGHT); break;
+		case 'D': ConStoreCharacter(M16_CON_CURSOR_LEFT); break;
+		case 'H': ConStoreCharacter(M16_CON_HOME); break;
+		case 'F': ConStoreCharacter(M16_CON_END); break;
+		case '~':
+			if (rx_param == 1 || rx_param == 7) ConStoreCharacter(M16_CON_HOME);
+			else if (rx_param == 4 || rx_param == 8) ConStoreCharacter(M16_CON_END);
+			else if (rx_param == 5) ConStoreCharacter(M16_CON_PGUP);
+			else if (rx_param == 6) ConStoreCharacter(M16_CON_PGDOWN);
+			break;
+		}
+		return;
+	}
+
+	bool cr = rx_cr;
+	rx_cr = (c == 13);
+	switch (c) {
+	case 27:  rx_state = 1; rx_esc_us = time_us_32(); break;
+	case 127: ConStoreCharacter(8); break;
+	case 10:  if (!cr) ConStoreCharacter(13); break;		// a bare LF ends the line like CR
+	case 2:   ConStoreCharacter(M16_CON_CTRL_B); break;
+	case 12:  ConStoreCharacter(M16_CON_CTRL_L); break;
+	case 17:  ConStoreCharacter(M16_CON_CTRL_Q); break;
+	case 18:  ConStoreCharacter(M16_CON_CTRL_R); break;
+	case 19:  ConStoreCharacter(M16_CON_CTRL_S); break;
+	default:  ConStoreCharacter(c); break;		// does input validation
+	}
+}
+
+// pick up what the RX DMA has written since the last call, as much as the
+// console input stream takes: the rest waits in the ring
+void UC_Poll() {
+	if (!uc_open)
+		return;
+	// free running count of the bytes written: the ring offset is its low bits
+	uint32_t head = rx_base + (0xffffffff - dma_hw->ch[rx_chan].transfer_count);
+	if (head - rx_tail > RX_SIZE) {
+		// the DMA went round the ring past what was not read yet
+		rx_lost += head - rx_tail - RX_SIZE;
+		rx_tail = head - RX_SIZE;
+		rx_state = 0;
+	}
+	while (rx_tail != head && ConInputRoom()) {
+		_Receive(rx_ring[rx_tail & RX_MASK]);
+		rx_tail++;
+		rx_bytes++;
+	}
+	if (rx_state == 1 && time_us_32() - rx_esc_us > ESC_TIMEOUT_US) {
+		rx_state = 0;
+		ConStoreCharacter(27);
+	}
+	// the transfer count runs out after 4G characters: carry on where it stopped
+	if (!dma_channel_is_busy(rx_chan)) {
+		rx_base += 0xffffffff;
+		dma_channel_set_trans_count(rx_chan, 0xffffffff, true);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void _uart_cmd(struct cmd_arg *args, int nargs) {
+	static const char *modes[] = { "off", "plain", "ansi" };
+	if (nargs == 1) {
+		int m = atoi(args[0].str);
+		if (m < UC_MODE_OFF || m > UC_MODE_ANSI) {
+			Con_printf("Invalid mode\n");
+			return;
+		}
+		UC_SetMode(m);
+	}
+	uint32_t tx, dropped, rx, lost;
+	UC_GetStats(&tx, &dropped, &rx, &lost);
+	Con_printf("uart1 %d baud, %s\n", UC_BAUDRATE, modes[mode]);
+	Con_printf("tx %lu (%lu dropped) rx %lu (%lu lost)\n", (unsigned long)tx, (unsigned long)dropped,
+		(unsigned long)rx, (unsigned long)lost);
+}
+
+void UC_Open() {
+	uart_init(UC_UART, UC_BAUDRATE);
+	gpio_set_function(UC_TX_PIN, GPIO_FUNC_UART);
+	gpio_set_function(UC_RX_PIN, GPIO_FUNC_UART);
+	uart_set_fifo_enabled(UC_UART, true);
+
+	// TX: ring -> uart, one transfer per batch of output
+	tx_chan = dma_claim_unused_channel(true);
+	dma_channel_config c = dma_channel_get_default_config(tx_chan);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_ring(&c, false, UC_TX_RING_BITS);
+	channel_config_set_dreq(&c, uart_get_dreq(UC_UART, true));
+	dma_channel_configure(tx_chan, &c, &uart_get_hw(UC_UART)->dr, tx_ring, 0, false);
+
+	// core1 has DMA_IRQ_0 for the DVI
+	dma_channel_set_irq1_enabled(tx_chan, true);
+	irq_add_shared_handler(DMA_IRQ_1, _TxDone, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+	irq_set_enabled(DMA_IRQ_1, true);
+
+	// RX: uart -> ring, runs all the time
+	rx_chan = dma_claim_unused_channel(true);
+	c = dma_channel_get_default_config(rx_chan);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, UC_RX_RING_BITS);
+	channel_config_set_dreq(&c, uart_get_dreq(UC_UART, false));
+	dma_channel_configure(rx_chan, &c, rx_ring, &uart_get_hw(UC_UART)->dr, 0xffffffff, true);
+
+	uc_open = true;
+	mode = UC_MODE_PLAIN;
+
+	ShellRegisterCommand("UART", _uart_cmd, 0, 1, "UART [mode] - Console bridge: 0 off, 1 plain, 2 ansi");
+}
+
+void UC_SetMode(int m) {
+	if (uc_open && m >= UC_MODE_OFF && m <= UC_MODE_ANSI)
+		mode = m;
+}
+
+int UC_GetMode() {
+	return mode;
+}
+
+void UC_GetStats(uint32_t *tx, uint32_t *dropped, uint32_t *rx, uint32_t *lost) {
+	*tx = tx_bytes;
+	*dropped = tx_dropped;
+	*rx = rx_bytes;
+	*lost = rx_lost;
+}
+
+// uartcon.c
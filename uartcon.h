@@ -0,0 +1,49 @@
+#pragma once
+
+/* -------------------------------------------------------
+ * UART CONSOLE BRIDGE
+ * a second serial port (uart1, the stdio debug output stays on
+ * uart0) that feeds the shown console's input stream and mirrors
+ * its output. Both directions go through DMA rings: output is
+ * copied into the TX ring and sent in the background, input is
+ * picked up from the RX ring by the usb timer interrupt.
+ * Host cursor keys (ESC [ A etc.) arrive as the usual meta codes
+ * ------------------------------------------------------*/
+
+#include <stdint.h>
+
+#ifndef UC_BAUDRATE
+#define UC_BAUDRATE 921600
+#endif
+
+#define UC_TX_PIN 8
+#define UC_RX_PIN 9
+
+// ring sizes as powers of two (the DMA ring wraps at this alignment)
+// the RX ring holds 44ms of input at 921600 baud, the timer empties it every 1ms
+#define UC_TX_RING_BITS 11
+#define UC_RX_RING_BITS 12
+
+// output mirroring
+#define UC_MODE_OFF		0
+#define UC_MODE_PLAIN	1	// console output as is (LF sent as CR LF)
+#define UC_MODE_ANSI	2	// plus cursor positioning, colours and clearing as ANSI sequences
+
+void UC_Open();
+void UC_SetMode(int mode);
+int UC_GetMode();
+
+// console output (main loop only)
+void UC_Write(const char *p, int n);
+void UC_CursorTo(int row, int col);
+void UC_Color(int fg, int bg);
+void UC_ClearRow();
+void UC_ClearScreen();
+
+// called by the usb timer interrupt (main.c)
+void UC_Poll();
+
+// rx_lost: bytes the RX DMA overwrote before they were picked up
+void UC_GetStats(uint32_t *tx_bytes, uint32_t *tx_dropped, uint32_t *rx_bytes, uint32_t *rx_lost);
+
+// uartcon.h